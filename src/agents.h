@@ -0,0 +1,40 @@
+#ifndef MOBIUS_AGENTS_H
+#define MOBIUS_AGENTS_H
+
+#include "rigid_transform.h"
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <cstdint>
+#include <vector>
+
+// Lots of players at once, for seeing how a world gets navigated at scale.
+// Agents move just like the player, but only collide with chunks (not with
+// objects, or each other), so that World::update can step them all
+// independently. Their state is kept in arrays, one element per agent.
+struct Agents {
+  uint32_t size() const
+  {
+    return uint32_t(positions.size());
+  }
+
+  // Adds an agent at rest, and returns its index.
+  uint32_t add(uint32_t chunk, const RigidTransform& orientation,
+               const glm::vec3& position)
+  {
+    auto index = size();
+    active_chunks.push_back(chunk);
+    orientations.push_back(orientation);
+    positions.push_back(position);
+    angles.push_back({0, 0});
+    fall_speeds.push_back(0);
+    return index;
+  }
+
+  std::vector<uint32_t> active_chunks;
+  std::vector<RigidTransform> orientations;
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec2> angles;
+  std::vector<float> fall_speeds;
+};
+
+#endif
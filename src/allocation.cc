@@ -0,0 +1,69 @@
+#include "allocation.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+  thread_local uint64_t allocations = 0;
+
+  void* allocate(std::size_t size)
+  {
+    ++allocations;
+    if (auto p = std::malloc(size ? size : 1)) {
+      return p;
+    }
+    throw std::bad_alloc{};
+  }
+}
+
+uint64_t allocation_count()
+{
+  return allocations;
+}
+
+void* operator new(std::size_t size)
+{
+  return allocate(size);
+}
+
+void* operator new[](std::size_t size)
+{
+  return allocate(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  try {
+    return allocate(size);
+  } catch (const std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+  try {
+    return allocate(size);
+  } catch (const std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+  std::free(p);
+}
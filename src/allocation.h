@@ -0,0 +1,11 @@
+#ifndef MOBIUS_ALLOCATION_H
+#define MOBIUS_ALLOCATION_H
+
+#include <cstdint>
+
+// Number of calls to the global operator new so far, on this thread. This
+// replaces operator new for the whole program, so it's only built into the
+// client (not the core library).
+uint64_t allocation_count();
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef MOBIUS_ARENA_H
+#define MOBIUS_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Linear allocator for scratch data that lives for at most a frame. Nothing
+// is freed until reset(), which also merges the blocks so that once the
+// arena has grown to fit a frame, frames make no heap allocations at all.
+class Arena {
+public:
+  Arena(size_t block_size = 1 << 16)
+  : _block_size{block_size}
+  {
+  }
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* allocate(size_t size, size_t alignment)
+  {
+    if (!_blocks.empty()) {
+      auto& b = *_blocks.rbegin();
+      auto address = reinterpret_cast<uintptr_t>(b.data.get()) + _used;
+      auto padding = (alignment - address % alignment) % alignment;
+      if (_used + padding + size <= b.size) {
+        _used += padding + size;
+        return reinterpret_cast<void*>(address + padding);
+      }
+    }
+    auto block_size = std::max(_block_size, size + alignment);
+    if (!_blocks.empty()) {
+      block_size = std::max(block_size, 2 * _blocks.rbegin()->size);
+    }
+    _blocks.push_back({std::unique_ptr<char[]>{new char[block_size]},
+                       block_size});
+    _used = 0;
+    return allocate(size, alignment);
+  }
+
+  // Objects made this way are never destroyed, so they shouldn't own
+  // anything outside the arena.
+  template<typename T, typename... Args>
+  T* create(Args&&... args)
+  {
+    return new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+  }
+
+  void reset()
+  {
+    if (_blocks.size() > 1) {
+      size_t total = 0;
+      for (const auto& b : _blocks) {
+        total += b.size;
+      }
+      _blocks.clear();
+      _blocks.push_back({std::unique_ptr<char[]>{new char[total]}, total});
+    }
+    _used = 0;
+  }
+
+private:
+  struct block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  size_t _block_size;
+  std::vector<block> _blocks;
+  size_t _used = 0;
+};
+
+template<typename T>
+struct ArenaAllocator {
+  typedef T value_type;
+
+  ArenaAllocator(Arena& arena)
+  : arena{&arena}
+  {
+  }
+
+  template<typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other)
+  : arena{other.arena}
+  {
+  }
+
+  T* allocate(size_t n)
+  {
+    return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T*, size_t)
+  {
+  }
+
+  Arena* arena;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+  return a.arena == b.arena;
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+  return a.arena != b.arena;
+}
+
+template<typename T>
+using arena_vector = std::vector<T, ArenaAllocator<T>>;
+
+#endif
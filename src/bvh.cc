@@ -0,0 +1,147 @@
+#include "bvh.h"
+#include "plane_set.h"
+#include <glm/common.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+  static const uint32_t MAX_LEAF_SIZE = 4;
+  static const uint32_t MAX_DEPTH = 64;
+
+  Bounds merge(const Bounds& a, const Bounds& b)
+  {
+    return {glm::min(a.min, b.min), glm::max(a.max, b.max)};
+  }
+
+  // Slab test of the segment from origin to origin + direction.
+  bool segment_intersects(const glm::vec3& origin, const glm::vec3& direction,
+                          const Bounds& bounds)
+  {
+    float t_min = 0;
+    float t_max = 1;
+    for (int i = 0; i < 3; ++i) {
+      if (std::abs(direction[i]) < 1. / (1024 * 1024)) {
+        if (origin[i] < bounds.min[i] || origin[i] > bounds.max[i]) {
+          return false;
+        }
+        continue;
+      }
+      auto t0 = (bounds.min[i] - origin[i]) / direction[i];
+      auto t1 = (bounds.max[i] - origin[i]) / direction[i];
+      t_min = std::max(t_min, std::min(t0, t1));
+      t_max = std::min(t_max, std::max(t0, t1));
+      if (t_min > t_max) {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+Bvh::Bvh()
+{
+}
+
+Bvh::Bvh(const std::vector<Bounds>& bounds)
+{
+  if (bounds.empty()) {
+    return;
+  }
+  for (uint32_t i = 0; i < bounds.size(); ++i) {
+    _indices.push_back(i);
+  }
+  build(_indices, 0, uint32_t(_indices.size()), bounds);
+}
+
+void Bvh::query(const PlaneSet& planes, arena_vector<uint32_t>& result) const
+{
+  if (_nodes.empty()) {
+    return;
+  }
+  uint32_t stack[MAX_DEPTH];
+  uint32_t size = 0;
+  stack[size++] = 0;
+  while (size) {
+    auto index = stack[--size];
+    const auto& n = _nodes[index];
+    if (planes.excludes_box(n.bounds.min, n.bounds.max)) {
+      continue;
+    }
+    if (n.count) {
+      result.insert(result.end(), _indices.begin() + n.first,
+                    _indices.begin() + n.first + n.count);
+    } else {
+      stack[size++] = n.first;
+      stack[size++] = index + 1;
+    }
+  }
+}
+
+void Bvh::query(const glm::vec3& origin, const glm::vec3& direction,
+                const glm::vec3& extent, arena_vector<uint32_t>& result) const
+{
+  if (_nodes.empty()) {
+    return;
+  }
+  uint32_t stack[MAX_DEPTH];
+  uint32_t size = 0;
+  stack[size++] = 0;
+  while (size) {
+    auto index = stack[--size];
+    const auto& n = _nodes[index];
+    Bounds expanded{n.bounds.min - extent, n.bounds.max + extent};
+    if (!segment_intersects(origin, direction, expanded)) {
+      continue;
+    }
+    if (n.count) {
+      result.insert(result.end(), _indices.begin() + n.first,
+                    _indices.begin() + n.first + n.count);
+    } else {
+      stack[size++] = n.first;
+      stack[size++] = index + 1;
+    }
+  }
+}
+
+uint32_t Bvh::build(std::vector<uint32_t>& indices, uint32_t begin,
+                    uint32_t end, const std::vector<Bounds>& bounds)
+{
+  auto index = uint32_t(_nodes.size());
+  _nodes.emplace_back();
+
+  Bounds node_bounds = bounds[indices[begin]];
+  Bounds centre_bounds{node_bounds.min + node_bounds.max,
+                       node_bounds.min + node_bounds.max};
+  for (auto i = begin + 1; i < end; ++i) {
+    const auto& b = bounds[indices[i]];
+    node_bounds = merge(node_bounds, b);
+    centre_bounds = merge(centre_bounds, {b.min + b.max, b.min + b.max});
+  }
+  _nodes[index].bounds = node_bounds;
+
+  if (end - begin <= MAX_LEAF_SIZE) {
+    _nodes[index].first = begin;
+    _nodes[index].count = end - begin;
+    return index;
+  }
+
+  // Median split along the longest axis of the box centres. Since this is a
+  // balanced tree, the depth stays well below MAX_DEPTH.
+  auto extent = centre_bounds.max - centre_bounds.min;
+  int axis = extent.x > extent.y ?
+      (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+  auto middle = begin + (end - begin) / 2;
+  std::nth_element(
+      indices.begin() + begin, indices.begin() + middle,
+      indices.begin() + end, [&](uint32_t a, uint32_t b)
+      {
+        return bounds[a].min[axis] + bounds[a].max[axis] <
+            bounds[b].min[axis] + bounds[b].max[axis];
+      });
+
+  build(indices, begin, middle, bounds);
+  auto second = build(indices, middle, end, bounds);
+  _nodes[index].first = second;
+  _nodes[index].count = 0;
+  return index;
+}
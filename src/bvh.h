@@ -0,0 +1,47 @@
+#ifndef MOBIUS_BVH_H
+#define MOBIUS_BVH_H
+
+#include "arena.h"
+#include <glm/vec3.hpp>
+#include <cstdint>
+#include <vector>
+
+class PlaneSet;
+
+struct Bounds {
+  glm::vec3 min;
+  glm::vec3 max;
+};
+
+// Static bounding volume hierarchy over a list of boxes. Queries append the
+// indices of every box that might match to the result, in no particular
+// order.
+class Bvh {
+public:
+  Bvh();
+  Bvh(const std::vector<Bounds>& bounds);
+
+  // Boxes not entirely outside any of the planes.
+  void query(const PlaneSet& planes, arena_vector<uint32_t>& result) const;
+  // Boxes touched by a box of the given half-extent sweeping from origin to
+  // origin + direction.
+  void query(const glm::vec3& origin, const glm::vec3& direction,
+             const glm::vec3& extent, arena_vector<uint32_t>& result) const;
+
+private:
+  struct node {
+    Bounds bounds;
+    // For leaves, the range in _indices; otherwise, the second child (the
+    // first always immediately follows its parent).
+    uint32_t first;
+    uint32_t count;
+  };
+
+  uint32_t build(std::vector<uint32_t>& indices, uint32_t begin,
+                 uint32_t end, const std::vector<Bounds>& bounds);
+
+  std::vector<node> _nodes;
+  std::vector<uint32_t> _indices;
+};
+
+#endif
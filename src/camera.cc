@@ -0,0 +1,68 @@
+#include "camera.h"
+#include "geometry.h"
+#include "snapshot.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
+
+Camera::Camera(const Snapshot& snapshot, const glm::ivec2& dimensions)
+: eye{snapshot.eye}
+, dir{snapshot.look_direction}
+, side{side_direction(dir)}
+, up{glm::cross(side, dir)}
+, fov{snapshot.fov}
+, z_near{snapshot.z_near}
+, z_far{snapshot.z_far}
+, aspect_ratio{float(dimensions.x) / dimensions.y}
+{
+  auto f = std::tan(fov / 2);
+  view_max = {f * aspect_ratio, f};
+  view_min = -view_max;
+  pixel_scale = dimensions.y / (2 * f);
+  view_transform = glm::lookAt(eye, eye + dir, glm::vec3{0, 1, 0});
+  calculate_view_frustum();
+}
+
+Camera Camera::window(const glm::vec2& window_min,
+                      const glm::vec2& window_max) const
+{
+  auto result = *this;
+  result.view_min = window_min;
+  result.view_max = window_max;
+  result.calculate_view_frustum();
+  return result;
+}
+
+glm::vec2 Camera::view_plane_coords(const glm::vec3& v) const
+{
+  // Since the basis is orthonormal this is just the look-at matrix followed
+  // by the perspective divide.
+  auto relative = v - eye;
+  auto depth = glm::dot(relative, dir);
+  return {glm::dot(relative, side) / depth, glm::dot(relative, up) / depth};
+}
+
+glm::vec3 Camera::view_plane_point(const glm::vec2& coords) const
+{
+  return eye + dir + coords.x * side + coords.y * up;
+}
+
+glm::mat4 Camera::projection() const
+{
+  return glm::frustum(view_min.x * z_near, view_max.x * z_near,
+                      view_min.y * z_near, view_max.y * z_near, z_near, z_far);
+}
+
+void Camera::calculate_view_frustum()
+{
+  // The side planes all go through the eye.
+  glm::vec2 corners[] = {view_min, {view_max.x, view_min.y},
+                         view_max, {view_min.x, view_max.y}};
+  view_frustum.clear();
+  for (size_t i = 0; i < 4; ++i) {
+    auto a = view_plane_point(corners[i]);
+    auto b = view_plane_point(corners[(i + 1) % 4]);
+    view_frustum.add(a, glm::normalize(glm::cross(b - eye, a - eye)));
+  }
+  view_frustum.add(eye + z_near * dir, dir);
+  view_frustum.add(eye + z_far * dir, -dir);
+}
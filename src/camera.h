@@ -0,0 +1,50 @@
+#ifndef MOBIUS_CAMERA_H
+#define MOBIUS_CAMERA_H
+
+#include "plane_set.h"
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+struct Snapshot;
+// Everything about the view that stays fixed for a frame, so that it only
+// has to be worked out once.
+struct Camera {
+  Camera(const Snapshot& snapshot, const glm::ivec2& dimensions);
+
+  // The same camera, rendering only the given window of the view plane.
+  Camera window(const glm::vec2& window_min,
+                const glm::vec2& window_max) const;
+
+  // Perspective-projects a point onto the view plane (at distance 1 from the
+  // eye), in units of side and up.
+  glm::vec2 view_plane_coords(const glm::vec3& v) const;
+  glm::vec3 view_plane_point(const glm::vec2& coords) const;
+  glm::mat4 projection() const;
+
+  glm::vec3 eye;
+  glm::vec3 dir;
+  glm::vec3 side;
+  glm::vec3 up;
+
+  float fov;
+  float z_near;
+  float z_far;
+  float aspect_ratio;
+
+  // Rectangle of the view plane that's rendered.
+  glm::vec2 view_min;
+  glm::vec2 view_max;
+  // Pixels per unit length on the view plane.
+  float pixel_scale;
+
+  // Planes bounding everything that's rendered.
+  PlaneSet view_frustum;
+  // World space to camera space.
+  glm::mat4 view_transform;
+
+private:
+  void calculate_view_frustum();
+};
+
+#endif
@@ -1,18 +1,14 @@
 #include "collision.h"
 #include "mesh.h"
 #include <glm/vec4.hpp>
-#include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/packing.hpp>
 #include <glm/gtx/norm.hpp>
 #include <algorithm>
 
 namespace {
-  Triangle object_triangle(const Triangle& t, const glm::mat4& transform)
+  Triangle object_triangle(const Triangle& t, const RigidTransform& transform)
   {
-    return {
-      glm::vec3{transform * glm::vec4{t.a, 1.}},
-      glm::vec3{transform * glm::vec4{t.b, 1.}},
-      glm::vec3{transform * glm::vec4{t.c, 1.}}};
+    return {transform.point(t.a), transform.point(t.b), transform.point(t.c)};
   }
 }
 
@@ -45,7 +41,7 @@ float Collision::coefficient(
   // We will want to consider some sort of acceleration structure (spatial
   // index) at some point.
   for (const auto& v : object.mesh->physical_vertices()) {
-    auto vt = glm::vec3{object.transform * glm::vec4{v, 1.}};
+    auto vt = object.transform.point(v);
     for (const auto& env : environment) {
       for (const auto& t : env.mesh->physical_faces()) {
         bound_by(vt, true, object_triangle(t, env.transform));
@@ -65,7 +61,7 @@ float Collision::coefficient(
     auto tt = object_triangle(t, object.transform);
     for (const auto& env : environment) {
       for (const auto& v : env.mesh->physical_vertices()) {
-        bound_by(glm::vec3{env.transform * glm::vec4{v, 1.}}, false, tt);
+        bound_by(env.transform.point(v), false, tt);
         if (bound_scale <= 0) {
           break;
         }
@@ -106,7 +102,7 @@ glm::vec3 Collision::translation(
 
   Object next_object{
       object.mesh,
-      glm::translate(glm::mat4{1}, first_translation) * object.transform};
+      RigidTransform{first_translation} * object.transform};
   return first_translation +
       translation(next_object, environment, remaining, iterations - 1);
 }
@@ -1,15 +1,15 @@
 #ifndef MOBIOS_COLLISION_H
 #define MOBIUS_COLLISION_H
 
+#include "rigid_transform.h"
 #include <glm/vec3.hpp>
-#include <glm/mat4x4.hpp>
 #include <vector>
 
 struct Triangle;
 class Mesh;
 struct Object {
   const Mesh* mesh;
-  glm::mat4x4 transform;
+  RigidTransform transform;
 };
 
 class Collision {
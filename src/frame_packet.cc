@@ -0,0 +1,208 @@
+#include "frame_packet.h"
+#include "camera.h"
+#include "mesh.h"
+#include <glm/vec4.hpp>
+
+void FramePacket::reset(const glm::ivec2& dimensions)
+{
+  _dimensions = dimensions;
+  _query_count = 0;
+  _commands.clear();
+  _cameras.clear();
+  _worlds.clear();
+  _views.clear();
+  _instances.clear();
+  _instance_ranges.clear();
+  _uploads.clear();
+  _released.clear();
+  debug_text.clear();
+}
+
+void FramePacket::camera(const Camera& camera)
+{
+  add(CAMERA, uint32_t(_cameras.size()));
+  _cameras.push_back({camera.projection(), camera.view_transform, camera.eye,
+                      camera.dir, camera.side, camera.up, camera.z_near});
+}
+
+void FramePacket::world(const RigidTransform& world_transform,
+                        const PlaneSet& clip_planes)
+{
+  add(WORLD, uint32_t(_worlds.size()));
+  _worlds.push_back({world_transform, clip_planes});
+}
+
+void FramePacket::clear()
+{
+  add(CLEAR);
+}
+
+void FramePacket::clear_depth(uint32_t stencil_ref, uint32_t stencil_mask)
+{
+  add(CLEAR_DEPTH, NONE, nullptr, stencil_ref, stencil_mask);
+}
+
+void FramePacket::clear_stencil(uint32_t stencil_mask)
+{
+  add(CLEAR_STENCIL, NONE, nullptr, 0, 0, stencil_mask);
+}
+
+void FramePacket::begin_view(uint32_t slot, const glm::ivec2& dimensions)
+{
+  add(BEGIN_VIEW, uint32_t(_views.size()));
+  _views.push_back({slot, dimensions, {}});
+}
+
+void FramePacket::end_view()
+{
+  add(END_VIEW);
+}
+
+uint32_t FramePacket::query()
+{
+  return _query_count++;
+}
+
+void FramePacket::begin_condition(uint32_t query)
+{
+  add(BEGIN_CONDITION, query);
+}
+
+void FramePacket::end_condition()
+{
+  add(END_CONDITION);
+}
+
+void FramePacket::stencil(
+    const Mesh& mesh, uint32_t stencil_ref,
+    uint32_t test_mask, uint32_t write_mask, bool depth_eq, uint32_t query)
+{
+  add(STENCIL, NONE, &mesh, stencil_ref, test_mask, write_mask,
+      depth_eq, query);
+}
+
+void FramePacket::fill(const Mesh& mesh, uint32_t stencil_ref,
+                       uint32_t stencil_mask)
+{
+  add(FILL, NONE, &mesh, stencil_ref, stencil_mask);
+}
+
+void FramePacket::composite(const Mesh& mesh, uint32_t slot,
+                            const glm::mat4& view_vp_transform,
+                            uint32_t stencil_ref, uint32_t stencil_mask)
+{
+  add(COMPOSITE, uint32_t(_views.size()), &mesh, stencil_ref, stencil_mask);
+  _views.push_back({slot, {}, view_vp_transform});
+}
+
+void FramePacket::draw(const Mesh& mesh,
+                       uint32_t stencil_ref, uint32_t stencil_mask)
+{
+  add(DRAW, NONE, &mesh, stencil_ref, stencil_mask);
+  outline(mesh, stencil_ref, stencil_mask);
+}
+
+void FramePacket::outline(const Mesh& mesh,
+                          uint32_t stencil_ref, uint32_t stencil_mask)
+{
+  if (!mesh.outline_indices().empty()) {
+    add(OUTLINE, NONE, &mesh, stencil_ref, stencil_mask);
+  }
+}
+
+uint32_t FramePacket::instance(
+    const RigidTransform& transform, const PlaneSet& clip_planes,
+    uint32_t stencil_ref, uint32_t query)
+{
+  _instances.push_back({transform, clip_planes, stencil_ref, query});
+  return uint32_t(_instances.size() - 1);
+}
+
+void FramePacket::depth_instances(
+    const Mesh& mesh, uint32_t first_instance, uint32_t instance_count,
+    uint32_t stencil_mask)
+{
+  add(DEPTH_INSTANCES, uint32_t(_instance_ranges.size()), &mesh,
+      0, stencil_mask);
+  _instance_ranges.push_back({first_instance, instance_count});
+}
+
+void FramePacket::draw_instances(
+    const Mesh& mesh, uint32_t first_instance, uint32_t instance_count,
+    uint32_t stencil_mask)
+{
+  add(DRAW_INSTANCES, uint32_t(_instance_ranges.size()), &mesh,
+      0, stencil_mask);
+  _instance_ranges.push_back({first_instance, instance_count});
+}
+
+void FramePacket::upload(const Mesh& mesh)
+{
+  _uploads.push_back(&mesh);
+}
+
+void FramePacket::release(const std::shared_ptr<const Mesh>& mesh)
+{
+  _released.push_back(mesh);
+}
+
+const glm::ivec2& FramePacket::dimensions() const
+{
+  return _dimensions;
+}
+
+uint32_t FramePacket::query_count() const
+{
+  return _query_count;
+}
+
+const std::vector<FramePacket::command>& FramePacket::commands() const
+{
+  return _commands;
+}
+
+const std::vector<FramePacket::camera_state>& FramePacket::cameras() const
+{
+  return _cameras;
+}
+
+const std::vector<FramePacket::world_state>& FramePacket::worlds() const
+{
+  return _worlds;
+}
+
+const std::vector<FramePacket::view_state>& FramePacket::views() const
+{
+  return _views;
+}
+
+const std::vector<FramePacket::instance_state>&
+FramePacket::instances() const
+{
+  return _instances;
+}
+
+const std::vector<FramePacket::instance_range>&
+FramePacket::instance_ranges() const
+{
+  return _instance_ranges;
+}
+
+const std::vector<const Mesh*>& FramePacket::uploads() const
+{
+  return _uploads;
+}
+
+const std::vector<std::shared_ptr<const Mesh>>& FramePacket::released() const
+{
+  return _released;
+}
+
+void FramePacket::add(
+    command_type type, uint32_t index, const Mesh* mesh,
+    uint32_t stencil_ref, uint32_t test_mask, uint32_t write_mask,
+    bool depth_eq, uint32_t query)
+{
+  _commands.push_back(
+      {type, index, mesh, stencil_ref, test_mask, write_mask, depth_eq, query});
+}
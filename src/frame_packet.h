@@ -0,0 +1,180 @@
+#ifndef MOBIUS_FRAME_PACKET_H
+#define MOBIUS_FRAME_PACKET_H
+
+#include "plane_set.h"
+#include "rigid_transform.h"
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct Camera;
+class Mesh;
+
+// Everything the renderer does in a frame, recorded without touching GL so
+// that it can be built on one thread and played back on the one that owns
+// the context.
+//
+// Packets are reused from frame to frame, so that their storage is too.
+class FramePacket {
+public:
+  static const uint32_t NONE = 0xffffffff;
+
+  enum command_type {
+    CAMERA,
+    WORLD,
+    CLEAR,
+    CLEAR_DEPTH,
+    CLEAR_STENCIL,
+    BEGIN_VIEW,
+    END_VIEW,
+    BEGIN_CONDITION,
+    END_CONDITION,
+    STENCIL,
+    DEPTH_INSTANCES,
+    DRAW_INSTANCES,
+    FILL,
+    COMPOSITE,
+    DRAW,
+    OUTLINE,
+  };
+
+  struct command {
+    command_type type;
+    // Which camera, world, view, query or range of instances, depending on
+    // the type.
+    uint32_t index;
+    const Mesh* mesh;
+    uint32_t stencil_ref;
+    uint32_t test_mask;
+    uint32_t write_mask;
+    bool depth_eq;
+    // For stencil draws, the query to wrap the draw in (or NONE).
+    uint32_t query;
+  };
+
+  struct camera_state {
+    glm::mat4 projection;
+    glm::mat4 view_transform;
+    glm::vec3 eye;
+    // The rest is for outlines.
+    glm::vec3 dir;
+    glm::vec3 side;
+    glm::vec3 up;
+    float z_near;
+  };
+
+  struct world_state {
+    RigidTransform transform;
+    PlaneSet clip_planes;
+  };
+
+  struct view_state {
+    uint32_t slot;
+    glm::ivec2 dimensions;
+    glm::mat4 vp_transform;
+  };
+
+  // A copy of a mesh with a world of its own.
+  struct instance_state {
+    RigidTransform transform;
+    PlaneSet clip_planes;
+    uint32_t stencil_ref;
+    uint32_t query;
+  };
+
+  struct instance_range {
+    uint32_t first_instance;
+    uint32_t instance_count;
+  };
+
+  // Starts a new frame for a window of the given size.
+  void reset(const glm::ivec2& dimensions);
+
+  // These mirror the renderer.
+  void camera(const Camera& camera);
+  void world(const RigidTransform& world_transform,
+             const PlaneSet& clip_planes);
+
+  void clear();
+  void clear_depth(uint32_t stencil_ref, uint32_t stencil_mask);
+  void clear_stencil(uint32_t stencil_mask);
+
+  void begin_view(uint32_t slot, const glm::ivec2& dimensions);
+  void end_view();
+
+  // Queries are numbered from zero each frame. Everything between
+  // begin_condition and end_condition is drawn only if the query passed (or
+  // unconditionally, for NONE). Conditions don't nest.
+  uint32_t query();
+  void begin_condition(uint32_t query);
+  void end_condition();
+
+  void stencil(const Mesh& mesh, uint32_t stencil_ref,
+               uint32_t test_mask, uint32_t write_mask, bool depth_eq,
+               uint32_t query = NONE);
+  void fill(const Mesh& mesh, uint32_t stencil_ref, uint32_t stencil_mask);
+  void composite(const Mesh& mesh, uint32_t slot,
+                 const glm::mat4& view_vp_transform,
+                 uint32_t stencil_ref, uint32_t stencil_mask);
+  // Draws the mesh, along with its outlines as seen from the current camera.
+  void draw(const Mesh& mesh, uint32_t stencil_ref, uint32_t stencil_mask);
+  // Just the outlines.
+  void outline(const Mesh& mesh, uint32_t stencil_ref, uint32_t stencil_mask);
+
+  // Instances are numbered from zero each frame, and drawn in batches which
+  // ignore the current world. Each instance should only be drawn if its query
+  // passed, but might be drawn anyway; so its stencil had better hide it if
+  // not. Batches can't go inside conditions.
+  uint32_t instance(const RigidTransform& transform,
+                    const PlaneSet& clip_planes, uint32_t stencil_ref,
+                    uint32_t query = NONE);
+  void depth_instances(const Mesh& mesh, uint32_t first_instance,
+                       uint32_t instance_count, uint32_t stencil_mask);
+  void draw_instances(const Mesh& mesh, uint32_t first_instance,
+                      uint32_t instance_count, uint32_t stencil_mask);
+
+  // The mesh will be drawn soon, so the renderer should make its copy before
+  // the frame rather than in the middle of it.
+  void upload(const Mesh& mesh);
+  // The mesh is no longer needed: the renderer drops its copy once it's
+  // played this packet. Until then, the packet keeps the mesh alive, since
+  // earlier packets might still draw it.
+  void release(const std::shared_ptr<const Mesh>& mesh);
+
+  const glm::ivec2& dimensions() const;
+  uint32_t query_count() const;
+  const std::vector<command>& commands() const;
+  const std::vector<camera_state>& cameras() const;
+  const std::vector<world_state>& worlds() const;
+  const std::vector<view_state>& views() const;
+  const std::vector<instance_state>& instances() const;
+  const std::vector<instance_range>& instance_ranges() const;
+  const std::vector<const Mesh*>& uploads() const;
+  const std::vector<std::shared_ptr<const Mesh>>& released() const;
+
+  // Drawn over the top of the frame.
+  std::string debug_text;
+
+private:
+  void add(command_type type, uint32_t index = NONE,
+           const Mesh* mesh = nullptr, uint32_t stencil_ref = 0,
+           uint32_t test_mask = 0, uint32_t write_mask = 0,
+           bool depth_eq = false, uint32_t query = NONE);
+
+  glm::ivec2 _dimensions;
+  uint32_t _query_count = 0;
+  std::vector<command> _commands;
+  std::vector<camera_state> _cameras;
+  std::vector<world_state> _worlds;
+  std::vector<view_state> _views;
+  std::vector<instance_state> _instances;
+  std::vector<instance_range> _instance_ranges;
+  std::vector<const Mesh*> _uploads;
+  std::vector<std::shared_ptr<const Mesh>> _released;
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <GL/glew.h>
 #include <glm/vec2.hpp>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -29,6 +30,7 @@ public:
     GLEW_CHECK(GLEW_ARB_fragment_shader);
     GLEW_CHECK(GLEW_ARB_framebuffer_object);
     GLEW_CHECK(GLEW_EXT_framebuffer_multisample);
+    GLEW_CHECK(GLEW_ARB_occlusion_query2);
   }
 };
 
@@ -158,6 +160,15 @@ public:
     glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, target, texture, 0);
   }
 
+  // Leaves the texture bound to the unit, for samplers which are always given
+  // that unit (see GlProgram::texture_unit).
+  void bind_unit(GLuint unit) const
+  {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(target, texture);
+    glBindSampler(unit, sampler);
+  }
+
   ~GlTexture()
   {
     glDeleteSamplers(1, &sampler);
@@ -171,6 +182,80 @@ private:
   friend struct GlActiveProgram;
 };
 
+// A buffer of vec4s which shaders can read by index, for data streamed in
+// every frame.
+struct GlBufferTexture {
+public:
+  GlBufferTexture()
+  {
+    glGenBuffers(1, &buffer);
+    glGenTextures(1, &texture);
+  }
+
+  ~GlBufferTexture()
+  {
+    glDeleteTextures(1, &texture);
+    glDeleteBuffers(1, &buffer);
+  }
+
+  // Replaces all the data. The size should be a multiple of four.
+  void update(const std::vector<GLfloat>& data)
+  {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER,
+                 sizeof(GLfloat) * data.size(), data.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+  }
+
+private:
+  GLuint buffer = 0;
+  GLuint texture = 0;
+  friend struct GlActiveProgram;
+};
+
+// A buffer for uniform blocks, replaced wholesale every frame and bound a
+// range at a time.
+struct GlUniformBuffer {
+public:
+  GlUniformBuffer()
+  {
+    glGenBuffers(1, &buffer);
+  }
+
+  ~GlUniformBuffer()
+  {
+    glDeleteBuffers(1, &buffer);
+  }
+
+  void update(const std::vector<char>& data)
+  {
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+
+  // Offsets have to be multiples of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT.
+  void bind(GLuint binding, GLintptr offset, GLsizeiptr size) const
+  {
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+  }
+
+private:
+  GLuint buffer = 0;
+};
+
+// An active uniform of a program, looked up when it's linked. Samplers each
+// get a texture unit of their own, set once.
+struct GlUniform {
+  std::string name;
+  GLint location;
+  GLint unit;
+};
+
 struct GlActiveProgram {
 public:
   ~GlActiveProgram()
@@ -178,29 +263,50 @@ public:
     glUseProgram(0);
   }
 
-  GLuint uniform(const std::string& name) const
+  // Returns -1, which GL ignores, if there's no such uniform.
+  GLint uniform(const char* name) const
   {
-    return glGetUniformLocation(program, name.c_str());
+    auto u = find(name);
+    return u ? u->location : -1;
   }
 
-  void uniform_texture(const std::string& name, const GlTexture& texture) const
+  void uniform_texture(const char* name, const GlTexture& texture) const
   {
-    glUniform1i(uniform(name), texture_index);
-    glActiveTexture(GL_TEXTURE0 + texture_index);
-    glBindTexture(texture.target, texture.texture);
-    glBindSampler(texture_index, texture.sampler);
-    ++texture_index;
+    auto u = find(name);
+    if (u && u->unit >= 0) {
+      texture.bind_unit(u->unit);
+    }
+  }
+
+  void uniform_texture(const char* name, const GlBufferTexture& texture) const
+  {
+    auto u = find(name);
+    if (u && u->unit >= 0) {
+      glActiveTexture(GL_TEXTURE0 + u->unit);
+      glBindTexture(GL_TEXTURE_BUFFER, texture.texture);
+      glBindSampler(u->unit, 0);
+    }
   }
 
 private:
-  GlActiveProgram(GLuint program)
-  : program(program)
+  GlActiveProgram(GLuint program, const std::vector<GlUniform>& uniforms)
+  : uniforms(uniforms)
   {
     glUseProgram(program);
   }
 
-  GLuint program;
-  mutable GLuint texture_index = 0;
+  // There are only ever a handful, so this beats hashing the name.
+  const GlUniform* find(const char* name) const
+  {
+    for (const auto& u : uniforms) {
+      if (!std::strcmp(u.name.c_str(), name)) {
+        return &u;
+      }
+    }
+    return nullptr;
+  }
+
+  const std::vector<GlUniform>& uniforms;
   friend struct GlProgram;
 };
 
@@ -226,6 +332,7 @@ public:
       glDetachShader(program, shader.shader);
     }
     if (status == GL_TRUE) {
+      introspect();
       return;
     }
 
@@ -248,11 +355,67 @@ public:
 
   GlActiveProgram use() const
   {
-    return {program};
+    return {program, uniforms};
+  }
+
+  // Bindings and units are set up once, rather than every time the program
+  // is used.
+  void uniform_block(const char* name, GLuint binding) const
+  {
+    auto index = glGetUniformBlockIndex(program, name);
+    if (index != GL_INVALID_INDEX) {
+      glUniformBlockBinding(program, index, binding);
+    }
+  }
+
+  void texture_unit(const char* name, GLint unit)
+  {
+    for (auto& u : uniforms) {
+      if (u.name == name) {
+        u.unit = unit;
+        glUseProgram(program);
+        glUniform1i(u.location, unit);
+        glUseProgram(0);
+      }
+    }
   }
 
 private:
+  void introspect()
+  {
+    GLint count = 0;
+    GLint max_length = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::vector<GLchar> name(max_length + 1);
+
+    GLint next_unit = 0;
+    glUseProgram(program);
+    for (GLint i = 0; i < count; ++i) {
+      GLint size;
+      GLenum type;
+      glGetActiveUniform(program, i, GLsizei(name.size()), nullptr,
+                         &size, &type, name.data());
+      // Arrays are named after their first element.
+      std::string n{name.data()};
+      if (n.size() > 3 && !n.compare(n.size() - 3, 3, "[0]")) {
+        n.resize(n.size() - 3);
+      }
+      // Anything in a uniform block has no location.
+      auto location = glGetUniformLocation(program, n.c_str());
+      GLint unit = -1;
+      if (type == GL_SAMPLER_1D || type == GL_SAMPLER_2D ||
+          type == GL_SAMPLER_BUFFER) {
+        unit = next_unit++;
+        glUniform1i(location, unit);
+      }
+      uniforms.push_back({n, location, unit});
+    }
+    glUseProgram(0);
+  }
+
   GLuint program = 0;
+  std::vector<GlUniform> uniforms;
 };
 
 struct GlActiveFramebuffer {
@@ -341,11 +504,83 @@ private:
   std::unique_ptr<GlTexture> depth_stencil_texture;
 };
 
+struct GlActiveQuery {
+public:
+  ~GlActiveQuery()
+  {
+    glEndQuery(target);
+  }
+
+private:
+  GlActiveQuery(GLuint query, GLenum target)
+  : target(target)
+  {
+    glBeginQuery(target, query);
+  }
+
+  GLenum target;
+  friend struct GlQuery;
+};
+
+struct GlConditionalRender {
+public:
+  ~GlConditionalRender()
+  {
+    if (query) {
+      glEndConditionalRender();
+    }
+  }
+
+private:
+  GlConditionalRender(GLuint query, GLenum mode)
+  : query(query)
+  {
+    if (query) {
+      glBeginConditionalRender(query, mode);
+    }
+  }
+
+  GLuint query;
+  friend struct GlQuery;
+};
+
+struct GlQuery {
+public:
+  GlQuery()
+  {
+    glGenQueries(1, &query);
+  }
+
+  ~GlQuery()
+  {
+    glDeleteQueries(1, &query);
+  }
+
+  GlActiveQuery begin(GLenum target) const
+  {
+    return {query, target};
+  }
+
+  // Draws are skipped on the GPU if the query passed no samples. Nothing
+  // waits on the CPU side. A null query renders unconditionally.
+  static GlConditionalRender condition(const GlQuery* query, GLenum mode)
+  {
+    return {query ? query->query : 0, mode};
+  }
+
+private:
+  GLuint query = 0;
+};
+
 struct GlVertexData {
 public:
-  GlVertexData(const std::vector<GLfloat>& data,
-               const std::vector<GLushort>& indices, GLuint hint)
+  template<typename DataAllocator, typename IndexAllocator>
+  GlVertexData(const std::vector<GLfloat, DataAllocator>& data,
+               const std::vector<GLushort, IndexAllocator>& indices,
+               GLuint hint, GLenum mode = GL_TRIANGLES)
   : size(indices.size())
+  , hint(hint)
+  , mode(mode)
   {
     glGenBuffers(1, &vbo);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
@@ -386,15 +621,42 @@ public:
     glBindVertexArray(0);
   }
 
+  // Replaces all the data, for things that are streamed in every frame.
+  template<typename DataAllocator, typename IndexAllocator>
+  void update(const std::vector<GLfloat, DataAllocator>& data,
+              const std::vector<GLushort, IndexAllocator>& indices)
+  {
+    size = indices.size();
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER,
+                 sizeof(GLfloat) * data.size(), data.data(), hint);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindVertexArray(vao);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 sizeof(GLushort) * indices.size(), indices.data(), hint);
+    glBindVertexArray(0);
+  }
+
   void draw() const
   {
     glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, size, GL_UNSIGNED_SHORT, 0);
+    glDrawElements(mode, size, GL_UNSIGNED_SHORT, 0);
+    glBindVertexArray(0);
+  }
+
+  // Draws the whole thing count times, numbered by gl_InstanceID.
+  void draw_instanced(GLsizei count) const
+  {
+    glBindVertexArray(vao);
+    glDrawElementsInstanced(mode, size, GL_UNSIGNED_SHORT, 0, count);
     glBindVertexArray(0);
   }
 
 private:
   GLuint size;
+  GLuint hint;
+  GLenum mode;
   GLuint vbo = 0;
   GLuint ibo = 0;
   GLuint vao = 0;
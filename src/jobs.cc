@@ -0,0 +1,182 @@
+#include "jobs.h"
+#include <algorithm>
+
+namespace {
+  // Which jobs the current thread works for, if any, and in which slot.
+  thread_local const Jobs* current_jobs = nullptr;
+  thread_local uint32_t current_jobs_slot = Jobs::NONE;
+}
+
+Jobs::Jobs(uint32_t threads)
+{
+  for (uint32_t i = 0; i < threads; ++i) {
+    _queues.emplace_back(new queue);
+  }
+  for (uint32_t i = 0; i < threads; ++i) {
+    _threads.emplace_back(&Jobs::work, this, i);
+  }
+}
+
+Jobs::~Jobs()
+{
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _stopping = true;
+  }
+  for (auto& q : _queues) {
+    std::lock_guard<std::mutex> lock{q->mutex};
+    q->tasks.clear();
+  }
+  _condition.notify_all();
+  for (auto& thread : _threads) {
+    thread.join();
+  }
+}
+
+uint32_t Jobs::slots() const
+{
+  return std::max(uint32_t(1), uint32_t(_queues.size()));
+}
+
+Jobs::Group::Group(Jobs& jobs)
+: _jobs(jobs)
+{
+}
+
+Jobs::Group::~Group()
+{
+  wait();
+}
+
+void Jobs::Group::run(std::function<void(uint32_t slot)> task)
+{
+  if (_jobs._queues.empty()) {
+    task(0);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    ++_pending;
+  }
+  _jobs.push({std::move(task), this});
+}
+
+void Jobs::Group::wait()
+{
+  auto slot = _jobs.current_slot();
+  if (slot == NONE) {
+    std::unique_lock<std::mutex> lock{_mutex};
+    _condition.wait(lock, [&]{ return !_pending; });
+    return;
+  }
+  // A worker can't just sleep, since the tasks might be queued behind it.
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      if (!_pending) {
+        return;
+      }
+    }
+    task t;
+    if (_jobs.take(slot, t)) {
+      _jobs.execute(slot, t);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void Jobs::Group::finish()
+{
+  // Notified under the lock, so that the group is still there.
+  std::lock_guard<std::mutex> lock{_mutex};
+  if (!--_pending) {
+    _condition.notify_all();
+  }
+}
+
+void Jobs::parallel_for(
+    uint32_t begin, uint32_t end, uint32_t grain,
+    const std::function<void(uint32_t, uint32_t, uint32_t)>& f)
+{
+  Group group{*this};
+  grain = std::max(uint32_t(1), grain);
+  for (auto first = begin; first < end;) {
+    auto last = first + std::min(grain, end - first);
+    group.run([&f, first, last](uint32_t slot)
+    {
+      f(first, last, slot);
+    });
+    first = last;
+  }
+  group.wait();
+}
+
+void Jobs::push(task&& t)
+{
+  auto slot = current_slot();
+  if (slot == NONE) {
+    slot = _next++ % _queues.size();
+  }
+  {
+    auto& q = *_queues[slot];
+    std::lock_guard<std::mutex> lock{q.mutex};
+    q.tasks.push_back(std::move(t));
+  }
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    ++_queued;
+  }
+  _condition.notify_one();
+}
+
+bool Jobs::take(uint32_t slot, task& t)
+{
+  auto count = uint32_t(_queues.size());
+  for (uint32_t i = 0; i < count; ++i) {
+    auto& q = *_queues[(slot + i) % count];
+    std::lock_guard<std::mutex> lock{q.mutex};
+    if (q.tasks.empty()) {
+      continue;
+    }
+    if (i) {
+      t = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    } else {
+      t = std::move(q.tasks.back());
+      q.tasks.pop_back();
+    }
+    --_queued;
+    return true;
+  }
+  return false;
+}
+
+void Jobs::execute(uint32_t slot, task& t)
+{
+  t.run(slot);
+  t.group->finish();
+}
+
+void Jobs::work(uint32_t slot)
+{
+  current_jobs = this;
+  current_jobs_slot = slot;
+  while (true) {
+    task t;
+    if (take(slot, t)) {
+      execute(slot, t);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock{_mutex};
+    _condition.wait(lock, [&]{ return _stopping || _queued > 0; });
+    if (_stopping) {
+      return;
+    }
+  }
+}
+
+uint32_t Jobs::current_slot() const
+{
+  return current_jobs == this ? current_jobs_slot : NONE;
+}
@@ -0,0 +1,111 @@
+#ifndef MOBIUS_JOBS_H
+#define MOBIUS_JOBS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads shared by everything with work to spread out. Each worker
+// has a queue of its own: it takes the newest task from it, and when that
+// runs dry, steals the oldest from the others.
+//
+// With no workers, tasks are run on the spot by whichever thread adds them,
+// so that everything happens on one thread in a fixed order, for debugging.
+class Jobs {
+public:
+  static const uint32_t NONE = 0xffffffff;
+
+  explicit Jobs(uint32_t threads);
+  // Tasks that haven't started yet are dropped, and running ones are waited
+  // for, so any groups should be done with first.
+  ~Jobs();
+
+  // How many tasks can run at once. Each is given the slot it runs in, below
+  // this, so that it can use scratch space of its own (see PerThread).
+  uint32_t slots() const;
+
+  // Tasks added to a group can be waited for together. Waiting on a worker
+  // runs other tasks in the meantime, so tasks can fork and join too.
+  class Group {
+  public:
+    explicit Group(Jobs& jobs);
+    // Waits for anything still running.
+    ~Group();
+
+    void run(std::function<void(uint32_t slot)> task);
+    void wait();
+
+  private:
+    friend class Jobs;
+    void finish();
+
+    Jobs& _jobs;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    uint32_t _pending = 0;
+  };
+
+  // Calls f(begin, end, slot) on pieces of the range at most grain long, and
+  // waits for them all.
+  void parallel_for(
+      uint32_t begin, uint32_t end, uint32_t grain,
+      const std::function<void(uint32_t, uint32_t, uint32_t)>& f);
+
+private:
+  struct task {
+    std::function<void(uint32_t)> run;
+    Group* group;
+  };
+
+  struct queue {
+    std::mutex mutex;
+    std::deque<task> tasks;
+  };
+
+  void push(task&& t);
+  // Takes from the slot's own queue first, and then from the others.
+  bool take(uint32_t slot, task& t);
+  void execute(uint32_t slot, task& t);
+  void work(uint32_t slot);
+  // NONE unless called on one of the workers.
+  uint32_t current_slot() const;
+
+  std::vector<std::unique_ptr<queue>> _queues;
+  // Workers sleep until there's something queued.
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  std::atomic<int32_t> _queued{0};
+  bool _stopping = false;
+  // Tasks added from outside are spread across the queues.
+  std::atomic<uint32_t> _next{0};
+  std::vector<std::thread> _threads;
+};
+
+// Something for each slot of the jobs, so that tasks can have scratch space
+// without sharing it. Each is allocated separately, to keep them apart.
+template<typename T>
+class PerThread {
+public:
+  explicit PerThread(const Jobs& jobs)
+  {
+    for (uint32_t i = 0; i < jobs.slots(); ++i) {
+      _items.emplace_back(new T);
+    }
+  }
+
+  T& operator[](uint32_t slot)
+  {
+    return *_items[slot];
+  }
+
+private:
+  std::vector<std::unique_ptr<T>> _items;
+};
+
+#endif
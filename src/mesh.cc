@@ -3,48 +3,15 @@
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/packing.hpp>
-#include <GL/glew.h>
+#include <atomic>
 #include <unordered_set>
 
 namespace {
-  struct TriIndex {
-    size_t a;
-    size_t b;
-    size_t c;
-  };
-
-  glm::mat4 submesh_transform(const mobius::proto::submesh& submesh)
-  {
-    glm::mat4 transform{1};
-    if (submesh.has_translate()) {
-      transform *= glm::translate(glm::mat4{1}, load_vec3(submesh.translate()));
-    }
-    if (submesh.has_scale()) {
-      transform *= glm::scale(glm::mat4{1}, load_vec3(submesh.scale()));
-    }
-    return transform;
-  }
-
-  size_t geometry_size(const mobius::proto::geometry& geometry)
-  {
-    return geometry.tri_size() + 2 * geometry.quad_size();
-  }
-
-  TriIndex geometry_tri(
-      const mobius::proto::geometry& geometry, size_t index)
-  {
-    if (index < size_t(geometry.tri_size())) {
-      const auto& t = geometry.tri(index);
-      return TriIndex{t.a(), t.b(), t.c()};
-    }
-
-    const auto& q = geometry.quad((index - geometry.tri_size()) / 2);
-    return index % 2 ? TriIndex{q.a(), q.b(), q.c()} :
-        TriIndex{q.c(), q.d(), q.a()};
-  }
+  std::atomic<uint64_t> next_id{1};
 }
 
 Mesh::Mesh()
+: _id{next_id++}
 {
 }
 
@@ -54,24 +21,27 @@ Mesh::Mesh(const std::string& path)
 }
 
 Mesh::Mesh(const mobius::proto::mesh& mesh)
+: _id{next_id++}
 {
-  std::vector<float> visible_vertices;
-  std::vector<GLushort> visible_indices;
   for (size_t i = 0; i < unsigned(mesh.submesh_size()); ++i) {
-    generate_data(visible_vertices, visible_indices, mesh, mesh.submesh(i));
+    generate_data(_visible_vertices, _visible_indices, mesh, mesh.submesh(i));
     generate_outlines(mesh, mesh.submesh(i));
   }
-  _visible_data.reset(
-      new GlVertexData{visible_vertices, visible_indices, GL_STATIC_DRAW});
-  _visible_data->enable_attribute(0, 3, 8, 0);
-  _visible_data->enable_attribute(1, 3, 8, 3);
-  _visible_data->enable_attribute(2, 1, 8, 6);
-  _visible_data->enable_attribute(3, 1, 8, 7);
 }
 
-const GlVertexData& Mesh::visible_data() const
+uint64_t Mesh::id() const
+{
+  return _id;
+}
+
+const std::vector<float>& Mesh::visible_vertices() const
 {
-  return *_visible_data;
+  return _visible_vertices;
+}
+
+const std::vector<uint16_t>& Mesh::visible_indices() const
+{
+  return _visible_indices;
 }
 
 const std::vector<Triangle>& Mesh::physical_faces() const
@@ -84,13 +54,33 @@ const std::vector<glm::vec3>& Mesh::physical_vertices() const
   return _physical_vertices;
 }
 
-const std::vector<Mesh::outline_data>& Mesh::outlines() const
+const std::vector<float>& Mesh::outline_vertices() const
+{
+  return _outline_vertices;
+}
+
+const std::vector<uint16_t>& Mesh::outline_indices() const
+{
+  return _outline_indices;
+}
+
+size_t Mesh::cpu_bytes() const
+{
+  return sizeof(Mesh) + gpu_bytes() +
+      _physical_faces.capacity() * sizeof(Triangle) +
+      _physical_vertices.capacity() * sizeof(glm::vec3);
+}
+
+size_t Mesh::gpu_bytes() const
 {
-  return _outline_data;
+  return _visible_vertices.size() * sizeof(float) +
+      _visible_indices.size() * sizeof(uint16_t) +
+      _outline_vertices.size() * sizeof(float) +
+      _outline_indices.size() * sizeof(uint16_t);
 }
 
 void Mesh::generate_data(std::vector<float>& visible_vertices,
-                         std::vector<unsigned short>& visible_indices,
+                         std::vector<uint16_t>& visible_indices,
                          const mobius::proto::mesh& mesh,
                          const mobius::proto::submesh& submesh)
 {
@@ -133,9 +123,9 @@ void Mesh::generate_data(std::vector<float>& visible_vertices,
       add_visible_vertex_data(vb, normal);
       add_visible_vertex_data(vc, normal);
 
-      visible_indices.push_back(GLushort(visible_indices.size()));
-      visible_indices.push_back(GLushort(visible_indices.size()));
-      visible_indices.push_back(GLushort(visible_indices.size()));
+      visible_indices.push_back(uint16_t(visible_indices.size()));
+      visible_indices.push_back(uint16_t(visible_indices.size()));
+      visible_indices.push_back(uint16_t(visible_indices.size()));
     }
     if (flags & mobius::proto::submesh::PHYSICAL) {
       _physical_faces.push_back({va, vb, vc});
@@ -172,6 +162,20 @@ void Mesh::generate_outlines(const mobius::proto::mesh& mesh,
     return;
   }
 
+  auto add_outline_vertex = [&](const glm::vec3& v,
+                                const glm::vec3& t_normal,
+                                const glm::vec3& u_normal)
+  {
+    _outline_indices.push_back(uint16_t(_outline_vertices.size() / 11));
+    for (const auto& x : {v, t_normal, u_normal}) {
+      _outline_vertices.push_back(x.x);
+      _outline_vertices.push_back(x.y);
+      _outline_vertices.push_back(x.z);
+    }
+    _outline_vertices.push_back(hue);
+    _outline_vertices.push_back(hue_shift);
+  };
+
   auto check = [&](const glm::vec3& a0, const glm::vec3& a1,
                    const glm::vec3& b0, const glm::vec3& b1,
                    const glm::vec3& at,
@@ -179,7 +183,8 @@ void Mesh::generate_outlines(const mobius::proto::mesh& mesh,
   {
     // Skip concave edges.
     if (a0 == b1 && a1 == b0 && glm::dot(at - a0, b_normal) < 0) {
-      _outline_data.push_back({a0, a1, a_normal, b_normal, hue, hue_shift});
+      add_outline_vertex(a0, a_normal, b_normal);
+      add_outline_vertex(a1, a_normal, b_normal);
     }
   };
 
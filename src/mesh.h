@@ -1,11 +1,10 @@
 #ifndef MOBIUS_MESH_H
 #define MOBIUS_MESH_H
 
-#include "glo.h"
 #include <glm/vec3.hpp>
 #include <glm/mat4x4.hpp>
+#include <cstddef>
 #include <cstdint>
-#include <memory>
 #include <string>
 #include <vector>
 
@@ -28,33 +27,40 @@ public:
   Mesh(const std::string& path);
   Mesh(const mobius::proto::mesh& mesh);
 
-  struct outline_data {
-    glm::vec3 a;
-    glm::vec3 b;
-    glm::vec3 t_normal;
-    glm::vec3 u_normal;
-    float hue;
-    float hue_shift;
-  };
-
-  const GlVertexData& visible_data() const;
+  // Unique for the life of the process, so that copies made elsewhere (like
+  // on the GPU) can be keyed by it.
+  uint64_t id() const;
+  // Interleaved position, normal, hue and hue shift, drawn as triangles.
+  const std::vector<float>& visible_vertices() const;
+  const std::vector<uint16_t>& visible_indices() const;
   const std::vector<Triangle>& physical_faces() const;
   const std::vector<glm::vec3>& physical_vertices() const;
-  const std::vector<outline_data>& outlines() const;
+  // Edges that might be outlined, as lines: interleaved position, the normals
+  // of both faces, hue and hue shift. Whether they are is up to the shader.
+  const std::vector<float>& outline_vertices() const;
+  const std::vector<uint16_t>& outline_indices() const;
+
+  // Roughly how much memory the mesh takes up, and how much its visible data
+  // will take on the GPU.
+  size_t cpu_bytes() const;
+  size_t gpu_bytes() const;
 
 private:
   void generate_data(std::vector<float>& visible_vertices,
-                     std::vector<unsigned short>& visible_indices,
+                     std::vector<uint16_t>& visible_indices,
                      const mobius::proto::mesh& mesh,
                      const mobius::proto::submesh& submesh);
 
   void generate_outlines(const mobius::proto::mesh& mesh,
                          const mobius::proto::submesh& submesh);
 
-  std::unique_ptr<GlVertexData> _visible_data;
+  uint64_t _id;
+  std::vector<float> _visible_vertices;
+  std::vector<uint16_t> _visible_indices;
   std::vector<Triangle> _physical_faces;
   std::vector<glm::vec3> _physical_vertices;
-  std::vector<outline_data> _outline_data;
+  std::vector<float> _outline_vertices;
+  std::vector<uint16_t> _outline_indices;
 };
 
 #endif
@@ -1,8 +1,14 @@
+#include "allocation.h"
+#include "jobs.h"
 #include "render.h"
+#include "render_thread.h"
+#include "simulation.h"
 #include "world.h"
 #include <SFML/Graphics.hpp>
 #include <SFML/Window.hpp>
 #include <sstream>
+#include <string>
+#include <thread>
 
 glm::ivec2 window_size(const sf::Window& window)
 {
@@ -24,6 +30,18 @@ void reset_mouse_position(const sf::Window& window)
   set_mouse_position(window, window_size(window) / 2);
 }
 
+// The main, simulation and render threads are busy enough already. Can be
+// overridden on the command line; with 0, jobs run on whichever thread adds
+// them, in order, which makes things repeatable for debugging.
+uint32_t job_threads(int argc, char** argv)
+{
+  if (argc > 2) {
+    return uint32_t(std::stoul(argv[2]));
+  }
+  auto cores = std::thread::hardware_concurrency();
+  return cores > 4 ? cores - 3 : 1;
+}
+
 int main(int argc, char** argv)
 {
   std::string world_path = "gen/data/test.world.pb";
@@ -46,31 +64,31 @@ int main(int argc, char** argv)
   window.setVerticalSyncEnabled(true);
   Renderer renderer;
   renderer.resize(window_size(window));
-  World world{world_path, renderer};
+  Jobs jobs{job_threads(argc, argv)};
+  World world{world_path, jobs};
+  Simulation simulation{world};
+
+  // From here on, only the render thread touches GL.
+  window.setActive(false);
+  RenderThread render_thread{window, renderer, "assets/droidiga.otf"};
 
   sf::Clock clock;
   uint64_t frame_time_us = 1;
-  sf::Font font;
-  font.loadFromFile("assets/droidiga.otf");
-  sf::Text debug_text{"", font, 24};
-  debug_text.setColor(sf::Color::Black);
-  debug_text.setPosition(sf::Vector2f{8, 8});
 
+  // The window is closed when it's destroyed, after the render thread has
+  // stopped using it.
+  bool open = true;
   bool focus = true;
   ControlData control_data;
-  while (window.isOpen()) {
+  while (open) {
     sf::Event event;
     control_data.jump = false;
     while (window.pollEvent(event)) {
       if (event.type == sf::Event::Closed ||
           (event.type == sf::Event::KeyPressed &&
            event.key.code == sf::Keyboard::Escape)) {
-        window.close();
+        open = false;
       } else if (event.type == sf::Event::Resized) {
-        auto size = window_size(window);
-        renderer.resize(size);
-        window.setView(sf::View{sf::Vector2f(size.x / 2, size.y / 2),
-                                sf::Vector2f(size.x, size.y)});
         reset_mouse_position(window);
       } else if (event.type == sf::Event::GainedFocus) {
         focus = true;
@@ -111,22 +129,34 @@ int main(int argc, char** argv)
       control_data.mouse_move = glm::vec2{};
     }
 
+    simulation.set_controls(control_data);
+
+    // The render thread is still drawing the last frame while we build this
+    // one.
+    auto& packet = render_thread.begin_frame();
     RenderMetrics metrics;
-    world.update(control_data);
-    world.render(metrics);
-    renderer.render();
+    auto allocations = allocation_count();
+    packet.reset(window_size(window));
+    world.render(metrics, simulation.render_tick(), packet);
+    allocations = allocation_count() - allocations;
 
     std::stringstream ss;
     ss << "Chunks: " << metrics.chunks <<
+        (metrics.cached_graph ? " (cached)" : "") <<
         "\nDepth: " << metrics.depth <<
         "\nBreadth: " << metrics.breadth <<
+        "\nViews: " << metrics.views << " (" << metrics.cached_views <<
+        " cached)" <<
+        "\nResident: " << metrics.resident_chunks << " (" <<
+        (metrics.resident_cpu_bytes >> 20) << " MB, " <<
+        (metrics.resident_gpu_bytes >> 20) << " MB GPU, " <<
+        metrics.loading_chunks << " loading)" <<
+        "\nAllocations: " << allocations <<
         "\nFPS: " << uint32_t(1000000.f / frame_time_us);
 
-    debug_text.setString(ss.str());
-    window.resetGLStates();
-    window.draw(debug_text);
+    packet.debug_text = ss.str();
+    render_thread.end_frame();
     frame_time_us = clock.getElapsedTime().asMicroseconds();
-    window.display();
     clock.restart();
   }
   return 0;
@@ -0,0 +1,194 @@
+#ifndef MOBIUS_PLANE_SET_H
+#define MOBIUS_PLANE_SET_H
+
+#include "rigid_transform.h"
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/geometric.hpp>
+#include <cstdint>
+
+#if defined(__SSE__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MOBIUS_PLANE_SET_SSE
+#include <xmmintrin.h>
+#endif
+
+// Hardware limit on user clip distances.
+static const uint32_t MAX_CLIP_PLANES = 8;
+
+// Fixed-capacity set of planes dot(normal, v) + offset >= 0, stored as
+// separate arrays of components so that a point can be tested against four
+// planes at once.
+class PlaneSet {
+public:
+  static const uint32_t CAPACITY = 16;
+
+  PlaneSet()
+  {
+    clear();
+  }
+
+  void clear()
+  {
+    // Unused slots are zero, so they never count as outside.
+    for (uint32_t i = 0; i < CAPACITY; ++i) {
+      _x[i] = _y[i] = _z[i] = _d[i] = 0;
+    }
+    _size = 0;
+  }
+
+  uint32_t size() const
+  {
+    return _size;
+  }
+
+  bool empty() const
+  {
+    return !_size;
+  }
+
+  // Adds the plane through point with the given normal. Returns false if
+  // there is no room.
+  bool add(const glm::vec3& point, const glm::vec3& normal)
+  {
+    return add({normal, -glm::dot(normal, point)});
+  }
+
+  bool add(const glm::vec4& plane)
+  {
+    if (_size == CAPACITY) {
+      return false;
+    }
+    _x[_size] = plane.x;
+    _y[_size] = plane.y;
+    _z[_size] = plane.z;
+    _d[_size] = plane.w;
+    ++_size;
+    return true;
+  }
+
+  void append(const PlaneSet& planes)
+  {
+    for (uint32_t i = 0; i < planes.size(); ++i) {
+      add(planes.plane(i));
+    }
+  }
+
+  glm::vec3 normal(uint32_t i) const
+  {
+    return {_x[i], _y[i], _z[i]};
+  }
+
+  float offset(uint32_t i) const
+  {
+    return _d[i];
+  }
+
+  // Normal in xyz, offset in w.
+  glm::vec4 plane(uint32_t i) const
+  {
+    return {_x[i], _y[i], _z[i], _d[i]};
+  }
+
+  float distance(uint32_t i, const glm::vec3& v) const
+  {
+    return _x[i] * v.x + _y[i] * v.y + _z[i] * v.z + _d[i];
+  }
+
+  // Bit i is set if v is strictly on the negative side of plane i.
+  uint32_t outside_mask(const glm::vec3& v) const
+  {
+    uint32_t mask = 0;
+#ifdef MOBIUS_PLANE_SET_SSE
+    auto vx = _mm_set1_ps(v.x);
+    auto vy = _mm_set1_ps(v.y);
+    auto vz = _mm_set1_ps(v.z);
+    auto zero = _mm_setzero_ps();
+    for (uint32_t i = 0; i < _size; i += 4) {
+      auto dx = _mm_mul_ps(_mm_load_ps(_x + i), vx);
+      auto dy = _mm_mul_ps(_mm_load_ps(_y + i), vy);
+      auto dz = _mm_mul_ps(_mm_load_ps(_z + i), vz);
+      auto d = _mm_add_ps(_mm_add_ps(dx, dy),
+                          _mm_add_ps(dz, _mm_load_ps(_d + i)));
+      mask |= uint32_t(_mm_movemask_ps(_mm_cmplt_ps(d, zero))) << i;
+    }
+#else
+    for (uint32_t i = 0; i < _size; ++i) {
+      mask |= uint32_t(distance(i, v) < 0) << i;
+    }
+#endif
+    return mask;
+  }
+
+  // True if the axis-aligned box lies entirely outside some single plane.
+  bool excludes_box(const glm::vec3& min, const glm::vec3& max) const
+  {
+#ifdef MOBIUS_PLANE_SET_SSE
+    auto min_x = _mm_set1_ps(min.x);
+    auto min_y = _mm_set1_ps(min.y);
+    auto min_z = _mm_set1_ps(min.z);
+    auto max_x = _mm_set1_ps(max.x);
+    auto max_y = _mm_set1_ps(max.y);
+    auto max_z = _mm_set1_ps(max.z);
+    auto zero = _mm_setzero_ps();
+    for (uint32_t i = 0; i < _size; i += 4) {
+      // Distance of whichever corner is furthest along each normal.
+      auto nx = _mm_load_ps(_x + i);
+      auto ny = _mm_load_ps(_y + i);
+      auto nz = _mm_load_ps(_z + i);
+      auto dx = _mm_max_ps(_mm_mul_ps(nx, min_x), _mm_mul_ps(nx, max_x));
+      auto dy = _mm_max_ps(_mm_mul_ps(ny, min_y), _mm_mul_ps(ny, max_y));
+      auto dz = _mm_max_ps(_mm_mul_ps(nz, min_z), _mm_mul_ps(nz, max_z));
+      auto d = _mm_add_ps(_mm_add_ps(dx, dy),
+                          _mm_add_ps(dz, _mm_load_ps(_d + i)));
+      if (_mm_movemask_ps(_mm_cmplt_ps(d, zero))) {
+        return true;
+      }
+    }
+#else
+    for (uint32_t i = 0; i < _size; ++i) {
+      glm::vec3 corner{_x[i] > 0 ? max.x : min.x,
+                       _y[i] > 0 ? max.y : min.y,
+                       _z[i] > 0 ? max.z : min.z};
+      if (distance(i, corner) < 0) {
+        return true;
+      }
+    }
+#endif
+    return false;
+  }
+
+  // The same planes in the space that transform maps from.
+  PlaneSet pull_back(const RigidTransform& transform) const
+  {
+    PlaneSet result;
+    auto inverse_rotation = glm::conjugate(transform.rotation);
+    for (uint32_t i = 0; i < _size; ++i) {
+      auto n = normal(i);
+      result.add(glm::vec4{inverse_rotation * n,
+                           _d[i] + glm::dot(n, transform.translation)});
+    }
+    return result;
+  }
+
+  bool contains(const glm::vec3& v) const
+  {
+    return !outside_mask(v);
+  }
+
+  // True if the triangle lies entirely outside some single plane.
+  bool excludes(const glm::vec3& a, const glm::vec3& b,
+                const glm::vec3& c) const
+  {
+    return outside_mask(a) & outside_mask(b) & outside_mask(c);
+  }
+
+private:
+  alignas(16) float _x[CAPACITY];
+  alignas(16) float _y[CAPACITY];
+  alignas(16) float _z[CAPACITY];
+  alignas(16) float _d[CAPACITY];
+  uint32_t _size;
+};
+
+#endif
@@ -2,7 +2,6 @@
 #include "collision.h"
 #include "geometry.h"
 #include <glm/gtc/constants.hpp>
-#include <glm/gtc/matrix_transform.hpp>
 #include <algorithm>
 
 Player::Player(const Collision& collision, const glm::vec3& position,
@@ -20,36 +19,46 @@ Player::Player(const Collision& collision, const glm::vec3& position,
 
 void Player::update(const ControlData& controls,
                     const std::vector<Object>& environment)
+{
+  _look_dir = move(_collision, _mesh, controls, environment,
+                   _position, _angle, _fall_speed);
+}
+
+glm::vec3 Player::move(
+    const Collision& collision, const Mesh& mesh,
+    const ControlData& controls, const std::vector<Object>& environment,
+    glm::vec3& position, glm::vec2& angle, float& fall_speed)
 {
   static const float epsilon = 1. / 1024;
-  _angle += (1.f / 2048) * controls.mouse_move;
-  _angle.y = glm::clamp(_angle.y, -glm::pi<float>() / 2 + epsilon,
-                                   glm::pi<float>() / 2 - epsilon);
-  _look_dir = glm::vec3{
-      cos(_angle.y) * sin(-_angle.x),
-      sin(_angle.y),
-      cos(_angle.y) * cos(-_angle.x)};
+  angle += (1.f / 2048) * controls.mouse_move;
+  angle.y = glm::clamp(angle.y, -glm::pi<float>() / 2 + epsilon,
+                                 glm::pi<float>() / 2 - epsilon);
+  glm::vec3 look_dir{
+      cos(angle.y) * sin(-angle.x),
+      sin(angle.y),
+      cos(angle.y) * cos(-angle.x)};
 
   auto velocity =
-      side_direction(_look_dir) * float(controls.right - controls.left) +
-      forward_direction(_look_dir) * float(controls.forward - controls.reverse);
+      side_direction(look_dir) * float(controls.right - controls.left) +
+      forward_direction(look_dir) * float(controls.forward - controls.reverse);
 
   if (velocity != glm::vec3{0, 0, 0}) {
     velocity = (1.f / 32) * glm::normalize(velocity);
     // TODO: sometimes the player gets stuck sliding along the wall. Why?
-    _position += _collision.translation(
-        {&_mesh, glm::translate(glm::mat4{}, _position)},
+    position += collision.translation(
+        {&mesh, RigidTransform{position}},
         environment, velocity, 8 /* iterations */);
   }
 
   if (controls.jump) {
-    _fall_speed = -1. / 16;
+    fall_speed = -1. / 16;
   }
-  _fall_speed = std::min(1. / 4, _fall_speed + 1. / 512);
-  _fall_speed *= _collision.coefficient(
-      {&_mesh, glm::translate(glm::mat4{}, _position)},
-      environment, {0, -_fall_speed, 0});
-  _position -= glm::vec3{0, _fall_speed, 0};
+  fall_speed = std::min(1. / 4, fall_speed + 1. / 512);
+  fall_speed *= collision.coefficient(
+      {&mesh, RigidTransform{position}},
+      environment, {0, -fall_speed, 0});
+  position -= glm::vec3{0, fall_speed, 0};
+  return look_dir;
 }
 
 const glm::vec3& Player::get_position() const
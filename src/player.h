@@ -26,6 +26,13 @@ public:
   void update(const ControlData& controls,
               const std::vector<Object>& environment);
 
+  // Moves anything shaped like the player for one tick, given the state it
+  // would have as a player. Returns the new look direction.
+  static glm::vec3 move(
+      const Collision& collision, const Mesh& mesh,
+      const ControlData& controls, const std::vector<Object>& environment,
+      glm::vec3& position, glm::vec2& angle, float& fall_speed);
+
   const glm::vec3& get_position() const;
   const glm::vec3& get_head_position() const;
   const glm::vec3& get_look_direction() const;
@@ -3,6 +3,9 @@
 
 #include "../gen/mobius.pb.h"
 #include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <cstddef>
 #include <fstream>
 
 template<typename T>
@@ -26,4 +29,42 @@ glm::vec3 load_rgb(const mobius::proto::rgb& v)
   return {v.r(), v.g(), v.b()};
 }
 
+struct TriIndex {
+  size_t a;
+  size_t b;
+  size_t c;
+};
+
+inline
+glm::mat4 submesh_transform(const mobius::proto::submesh& submesh)
+{
+  glm::mat4 transform{1};
+  if (submesh.has_translate()) {
+    transform *= glm::translate(glm::mat4{1}, load_vec3(submesh.translate()));
+  }
+  if (submesh.has_scale()) {
+    transform *= glm::scale(glm::mat4{1}, load_vec3(submesh.scale()));
+  }
+  return transform;
+}
+
+inline
+size_t geometry_size(const mobius::proto::geometry& geometry)
+{
+  return geometry.tri_size() + 2 * geometry.quad_size();
+}
+
+inline
+TriIndex geometry_tri(const mobius::proto::geometry& geometry, size_t index)
+{
+  if (index < size_t(geometry.tri_size())) {
+    const auto& t = geometry.tri(index);
+    return TriIndex{t.a(), t.b(), t.c()};
+  }
+
+  const auto& q = geometry.quad((index - geometry.tri_size()) / 2);
+  return index % 2 ? TriIndex{q.a(), q.b(), q.c()} :
+      TriIndex{q.c(), q.d(), q.a()};
+}
+
 #endif
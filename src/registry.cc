@@ -0,0 +1,301 @@
+#include "registry.h"
+#include <glm/vec4.hpp>
+#include <glm/common.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+  // Cell coordinates are packed into 16 bits each, with the chunk above them.
+  static const int32_t CELL_LIMIT = 0x7fff;
+  // Empty cells aren't pruned until there are at least this many.
+  static const uint32_t MIN_PRUNED_CELLS = 256;
+
+  glm::ivec3 cell(const glm::vec3& v)
+  {
+    glm::ivec3 result;
+    for (int i = 0; i < 3; ++i) {
+      auto c = std::floor(v[i] / ObjectRegistry::CELL_SIZE);
+      result[i] = c < -CELL_LIMIT ? -CELL_LIMIT :
+          c > CELL_LIMIT ? CELL_LIMIT : int32_t(c);
+    }
+    return result;
+  }
+
+  uint64_t cell_key(uint32_t chunk, const glm::ivec3& cell)
+  {
+    return uint64_t(chunk) << 48 |
+        uint64_t(uint16_t(cell.x + CELL_LIMIT)) << 32 |
+        uint64_t(uint16_t(cell.y + CELL_LIMIT)) << 16 |
+        uint64_t(uint16_t(cell.z + CELL_LIMIT));
+  }
+
+  bool overlaps(const Bounds& a, const Bounds& b)
+  {
+    for (int i = 0; i < 3; ++i) {
+      if (a.min[i] > b.max[i] || a.max[i] < b.min[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void erase_index(std::vector<uint32_t>& v, uint32_t index)
+  {
+    auto it = std::find(v.begin(), v.end(), index);
+    if (it != v.end()) {
+      *it = *v.rbegin();
+      v.pop_back();
+    }
+  }
+}
+
+uint32_t ObjectRegistry::add(const Mesh* mesh, float radius)
+{
+  uint32_t index;
+  if (_free_objects.empty()) {
+    index = uint32_t(_objects.size());
+    _objects.emplace_back();
+  } else {
+    index = *_free_objects.rbegin();
+    _free_objects.pop_back();
+  }
+  auto& o = _objects[index];
+  o.mesh = mesh;
+  o.radius = radius;
+  o.instance_count = 0;
+  return index;
+}
+
+void ObjectRegistry::remove(uint32_t object)
+{
+  auto& o = _objects[object];
+  for (uint32_t i = 0; i < o.instance_count; ++i) {
+    remove_instance(o.instances[i]);
+  }
+  o.mesh = nullptr;
+  o.instance_count = 0;
+  _free_objects.push_back(object);
+}
+
+void ObjectRegistry::place(
+    uint32_t object, const placement* placements, uint32_t count)
+{
+  auto& o = _objects[object];
+  count = std::min(count, MAX_INSTANCES);
+  // Instances are reused where possible, so that an object which hasn't
+  // moved far doesn't change buckets.
+  for (uint32_t i = 0; i < count; ++i) {
+    if (i < o.instance_count) {
+      move_instance(o.instances[i], placements[i], i);
+    } else {
+      o.instances[i] = add_instance(object, placements[i], i);
+    }
+  }
+  for (uint32_t i = count; i < o.instance_count; ++i) {
+    remove_instance(o.instances[i]);
+  }
+  o.instance_count = count;
+}
+
+const Mesh* ObjectRegistry::mesh(uint32_t object) const
+{
+  return _objects[object].mesh;
+}
+
+float ObjectRegistry::radius(uint32_t object) const
+{
+  return _objects[object].radius;
+}
+
+const ObjectRegistry::instance& ObjectRegistry::get(uint32_t instance) const
+{
+  return _instances[instance];
+}
+
+void ObjectRegistry::query(
+    uint32_t chunk, arena_vector<uint32_t>& result) const
+{
+  if (chunk < _chunks.size()) {
+    result.insert(result.end(), _chunks[chunk].begin(), _chunks[chunk].end());
+  }
+}
+
+void ObjectRegistry::query(uint32_t chunk, const Bounds& bounds,
+                           arena_vector<uint32_t>& result) const
+{
+  if (chunk >= _chunks.size()) {
+    return;
+  }
+  const auto& in_chunk = _chunks[chunk];
+  auto min = cell(bounds.min);
+  auto max = cell(bounds.max);
+
+  // For big regions it's quicker to look at everything in the chunk.
+  uint64_t cells = uint64_t(max.x - min.x + 1) *
+      uint64_t(max.y - min.y + 1) * uint64_t(max.z - min.z + 1);
+  if (cells > in_chunk.size()) {
+    for (auto index : in_chunk) {
+      if (overlaps(_instances[index].bounds, bounds)) {
+        result.push_back(index);
+      }
+    }
+    return;
+  }
+
+  glm::ivec3 c;
+  for (c.z = min.z; c.z <= max.z; ++c.z) {
+    for (c.y = min.y; c.y <= max.y; ++c.y) {
+      for (c.x = min.x; c.x <= max.x; ++c.x) {
+        auto it = _cells.find(cell_key(chunk, c));
+        if (it == _cells.end()) {
+          continue;
+        }
+        for (auto index : it->second) {
+          // Instances in several cells are only reported from the first of
+          // them in the region.
+          const auto& i = _instances[index];
+          if (std::max(i.cell_min.x, min.x) == c.x &&
+              std::max(i.cell_min.y, min.y) == c.y &&
+              std::max(i.cell_min.z, min.z) == c.z &&
+              overlaps(i.bounds, bounds)) {
+            result.push_back(index);
+          }
+        }
+      }
+    }
+  }
+}
+
+uint32_t ObjectRegistry::add_instance(
+    uint32_t object, const placement& p, uint32_t placement_index)
+{
+  uint32_t index;
+  if (_free_instances.empty()) {
+    index = uint32_t(_instances.size());
+    _instances.emplace_back();
+  } else {
+    index = *_free_instances.rbegin();
+    _free_instances.pop_back();
+  }
+
+  auto& i = _instances[index];
+  const auto& origin = p.transform.translation;
+  auto radius = _objects[object].radius;
+  i.object = object;
+  i.chunk = p.chunk;
+  i.transform = p.transform;
+  i.placement = placement_index;
+  i.bounds = {origin - glm::vec3{radius}, origin + glm::vec3{radius}};
+  i.cell_min = cell(i.bounds.min);
+  i.cell_max = cell(i.bounds.max);
+  add_to_chunk(index);
+  add_to_cells(index);
+  return index;
+}
+
+void ObjectRegistry::remove_instance(uint32_t instance)
+{
+  remove_from_cells(instance);
+  remove_from_chunk(instance);
+  _instances[instance].object = NONE;
+  _free_instances.push_back(instance);
+}
+
+void ObjectRegistry::move_instance(
+    uint32_t instance, const placement& p, uint32_t placement_index)
+{
+  auto& i = _instances[instance];
+  const auto& origin = p.transform.translation;
+  auto radius = _objects[i.object].radius;
+  Bounds bounds{origin - glm::vec3{radius}, origin + glm::vec3{radius}};
+  auto min = cell(bounds.min);
+  auto max = cell(bounds.max);
+
+  bool same_chunk = i.chunk == p.chunk;
+  bool same_cells = same_chunk && i.cell_min == min && i.cell_max == max;
+  if (!same_cells) {
+    remove_from_cells(instance);
+  }
+  if (!same_chunk) {
+    remove_from_chunk(instance);
+  }
+  i.chunk = p.chunk;
+  i.transform = p.transform;
+  i.placement = placement_index;
+  i.bounds = bounds;
+  i.cell_min = min;
+  i.cell_max = max;
+  if (!same_chunk) {
+    add_to_chunk(instance);
+  }
+  if (!same_cells) {
+    add_to_cells(instance);
+  }
+}
+
+void ObjectRegistry::add_to_chunk(uint32_t instance)
+{
+  auto& i = _instances[instance];
+  if (i.chunk >= _chunks.size()) {
+    _chunks.resize(1 + i.chunk);
+  }
+  i.chunk_slot = uint32_t(_chunks[i.chunk].size());
+  _chunks[i.chunk].push_back(instance);
+}
+
+void ObjectRegistry::remove_from_chunk(uint32_t instance)
+{
+  const auto& i = _instances[instance];
+  auto& in_chunk = _chunks[i.chunk];
+  auto last = *in_chunk.rbegin();
+  in_chunk[i.chunk_slot] = last;
+  _instances[last].chunk_slot = i.chunk_slot;
+  in_chunk.pop_back();
+}
+
+void ObjectRegistry::add_to_cells(uint32_t instance)
+{
+  const auto& i = _instances[instance];
+  glm::ivec3 c;
+  for (c.z = i.cell_min.z; c.z <= i.cell_max.z; ++c.z) {
+    for (c.y = i.cell_min.y; c.y <= i.cell_max.y; ++c.y) {
+      for (c.x = i.cell_min.x; c.x <= i.cell_max.x; ++c.x) {
+        auto& in_cell = _cells[cell_key(i.chunk, c)];
+        if (in_cell.empty() && in_cell.capacity()) {
+          --_empty_cells;
+        }
+        in_cell.push_back(instance);
+      }
+    }
+  }
+}
+
+void ObjectRegistry::remove_from_cells(uint32_t instance)
+{
+  const auto& i = _instances[instance];
+  glm::ivec3 c;
+  for (c.z = i.cell_min.z; c.z <= i.cell_max.z; ++c.z) {
+    for (c.y = i.cell_min.y; c.y <= i.cell_max.y; ++c.y) {
+      for (c.x = i.cell_min.x; c.x <= i.cell_max.x; ++c.x) {
+        auto it = _cells.find(cell_key(i.chunk, c));
+        if (it != _cells.end() && !it->second.empty()) {
+          erase_index(it->second, instance);
+          if (it->second.empty()) {
+            ++_empty_cells;
+          }
+        }
+      }
+    }
+  }
+
+  if (_empty_cells >= MIN_PRUNED_CELLS && 2 * _empty_cells > _cells.size()) {
+    for (auto it = _cells.begin(); it != _cells.end();) {
+      if (it->second.empty()) {
+        it = _cells.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    _empty_cells = 0;
+  }
+}
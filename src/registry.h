@@ -0,0 +1,98 @@
+#ifndef MOBIUS_REGISTRY_H
+#define MOBIUS_REGISTRY_H
+
+#include "arena.h"
+#include "bvh.h"
+#include "rigid_transform.h"
+#include <glm/vec3.hpp>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class Mesh;
+
+// Dynamic objects, bucketed by chunk and then by cell of a uniform grid in
+// chunk space, so that the objects in a chunk or near some point can be
+// found without looking at all of them.
+//
+// An object can be placed in several chunks at once: where it actually is,
+// plus a ghost on the other side of each portal it straddles. Each placement
+// is an instance, and queries return instances.
+class ObjectRegistry {
+public:
+  static const uint32_t NONE = 0xffffffff;
+  static const uint32_t MAX_INSTANCES = 4;
+  // Side of the grid cells, in chunk space.
+  static constexpr float CELL_SIZE = 4;
+
+  struct placement {
+    uint32_t chunk;
+    RigidTransform transform;
+  };
+
+  struct instance {
+    uint32_t object;
+    uint32_t chunk;
+    RigidTransform transform;
+    // Index of the placement: 0 for the object itself, otherwise a ghost.
+    uint32_t placement;
+    Bounds bounds;
+
+    // Position in the chunk's list, and the range of cells it's in.
+    uint32_t chunk_slot;
+    glm::ivec3 cell_min;
+    glm::ivec3 cell_max;
+  };
+
+  // The object is bounded by a sphere of the given radius about its origin.
+  // It isn't anywhere until it's placed.
+  uint32_t add(const Mesh* mesh, float radius);
+  void remove(uint32_t object);
+  // The first placement is where the object really is, and the rest are its
+  // ghosts.
+  void place(uint32_t object, const placement* placements, uint32_t count);
+
+  const Mesh* mesh(uint32_t object) const;
+  float radius(uint32_t object) const;
+  const instance& get(uint32_t instance) const;
+
+  // Every instance in the chunk.
+  void query(uint32_t chunk, arena_vector<uint32_t>& result) const;
+  // Instances in the chunk whose bounds touch the box.
+  void query(uint32_t chunk, const Bounds& bounds,
+             arena_vector<uint32_t>& result) const;
+
+private:
+  struct object {
+    const Mesh* mesh;
+    float radius;
+    uint32_t instance_count;
+    uint32_t instances[MAX_INSTANCES];
+  };
+
+  uint32_t add_instance(uint32_t object, const placement& p,
+                        uint32_t placement_index);
+  void remove_instance(uint32_t instance);
+  void move_instance(uint32_t instance, const placement& p,
+                     uint32_t placement_index);
+
+  void add_to_chunk(uint32_t instance);
+  void remove_from_chunk(uint32_t instance);
+  void add_to_cells(uint32_t instance);
+  void remove_from_cells(uint32_t instance);
+
+  std::vector<object> _objects;
+  std::vector<uint32_t> _free_objects;
+  std::vector<instance> _instances;
+  std::vector<uint32_t> _free_instances;
+
+  // Instances in each chunk, in no particular order.
+  std::vector<std::vector<uint32_t>> _chunks;
+  // Instances touching each cell, keyed by chunk and cell. Cells that empty
+  // out are kept, so that objects moving back and forth don't allocate, and
+  // only pruned once they make up most of the map.
+  std::unordered_map<uint64_t, std::vector<uint32_t>> _cells;
+  uint32_t _empty_cells = 0;
+};
+
+#endif
@@ -1,11 +1,12 @@
 #include "render.h"
-#include "geometry.h"
-#include "player.h"
+#include "frame_packet.h"
 #include "mesh.h"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <GL/glew.h>
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <vector>
@@ -41,23 +42,84 @@ namespace {
       glDisable(GL_STENCIL_TEST);
     }
   }
+
+  // Shaders call STENCIL_EXPORT(ref) to set their own stencil ref, which does
+  // nothing without the extension. It has to go after the version.
+  std::string stencil_export(const std::string& source, bool enabled)
+  {
+    auto line = source.find('\n') + 1;
+    return source.substr(0, line) + (enabled ?
+        "#extension GL_ARB_shader_stencil_export : require\n"
+        "#define STENCIL_EXPORT(ref) gl_FragStencilRefARB = ref\n" :
+        "#define STENCIL_EXPORT(ref)\n") + source.substr(line);
+  }
+
+  // Texels taken up by each instance (see instance.glsl.h).
+  static const uint32_t INSTANCE_TEXELS = 13;
+
+  // Uniform blocks, laid out as std140 (see uniforms.glsl.h).
+  struct frame_uniforms {
+    glm::mat4 vp_transform;
+    glm::vec3 light_source;
+    int32_t simplex_use_permutation_lut;
+    glm::vec3 eye;
+    float z_near;
+    glm::vec3 dir;
+    float outline_width;
+    glm::vec3 side;
+    float side_padding;
+    glm::vec3 up;
+    float up_padding;
+  };
+  static_assert(sizeof(frame_uniforms) == 144, "frame_uniforms isn't std140");
+
+  struct draw_uniforms {
+    glm::mat4 world_transform;
+    glm::vec4 clip_planes[MAX_CLIP_PLANES];
+  };
+  static_assert(sizeof(draw_uniforms) == 192, "draw_uniforms isn't std140");
+
+  static const GLuint FRAME_BINDING = 0;
+  static const GLuint DRAW_BINDING = 1;
+  // The lookup tables are bound once a frame, to units nothing else uses.
+  static const GLint SIMPLEX_GRADIENT_UNIT = 14;
+  static const GLint SIMPLEX_PERMUTATION_UNIT = 15;
+
+  size_t block_stride(size_t size, GLint alignment)
+  {
+    return alignment > 0 ? (size + alignment - 1) / alignment * alignment :
+                           size;
+  }
 }
 
-#define SHADER(name, type) \
-  GlShader( \
-    #name, type, std::string(\
-      gen_shaders_##name##_glsl, \
-      gen_shaders_##name##_glsl + gen_shaders_##name##_glsl_len))
+#define SHADER_SOURCE(name) \
+  std::string( \
+    gen_shaders_##name##_glsl, \
+    gen_shaders_##name##_glsl + gen_shaders_##name##_glsl_len)
+
+#define SHADER(name, type) GlShader(#name, type, SHADER_SOURCE(name))
+
+#define STENCIL_SHADER(name) \
+  GlShader(#name, GL_FRAGMENT_SHADER, \
+           stencil_export(SHADER_SOURCE(name), _stencil_export))
 
 #define ARRAY_LENGTH(array) (sizeof(array) / sizeof(array[0]))
 
 #include "../gen/shaders/draw.vertex.glsl.h"
 #include "../gen/shaders/draw.fragment.glsl.h"
+#include "../gen/shaders/draw_instanced.vertex.glsl.h"
+#include "../gen/shaders/draw_instanced.fragment.glsl.h"
 #include "../gen/shaders/quad.vertex.glsl.h"
 #include "../gen/shaders/post.fragment.glsl.h"
 #include "../gen/shaders/world.vertex.glsl.h"
+#include "../gen/shaders/world_instanced.vertex.glsl.h"
+#include "../gen/shaders/stencil.fragment.glsl.h"
 #include "../gen/shaders/outline.vertex.glsl.h"
+#include "../gen/shaders/outline.geometry.glsl.h"
 #include "../gen/shaders/outline.fragment.glsl.h"
+#include "../gen/shaders/fill.fragment.glsl.h"
+#include "../gen/shaders/composite.vertex.glsl.h"
+#include "../gen/shaders/composite.fragment.glsl.h"
 #include "../gen/tools/simplex_lut.h"
 
 std::vector<GLfloat> quad_vertices{
@@ -72,14 +134,27 @@ std::vector<GLushort> quad_indices{
 };
 
 Renderer::Renderer()
-: _draw_program("main", {SHADER(draw_vertex, GL_VERTEX_SHADER),
+: _stencil_export{GLEW_ARB_shader_stencil_export != 0}
+, _draw_program("main", {SHADER(draw_vertex, GL_VERTEX_SHADER),
                          SHADER(draw_fragment, GL_FRAGMENT_SHADER)})
+, _draw_instanced_program{
+    "main_instanced", {SHADER(draw_instanced_vertex, GL_VERTEX_SHADER),
+                       STENCIL_SHADER(draw_instanced_fragment)}}
 , _quad_program{"quad", {SHADER(quad_vertex, GL_VERTEX_SHADER)}}
 , _post_program{"post", {SHADER(quad_vertex, GL_VERTEX_SHADER),
                          SHADER(post_fragment, GL_FRAGMENT_SHADER)}}
 , _world_program{"world", {SHADER(world_vertex, GL_VERTEX_SHADER)}}
+, _world_instanced_program{
+    "world_instanced", {SHADER(world_instanced_vertex, GL_VERTEX_SHADER),
+                        STENCIL_SHADER(stencil_fragment)}}
 , _outline_program{"outline", {SHADER(outline_vertex, GL_VERTEX_SHADER),
+                               SHADER(outline_geometry, GL_GEOMETRY_SHADER),
                                SHADER(outline_fragment, GL_FRAGMENT_SHADER)}}
+, _fill_program{"fill", {SHADER(world_vertex, GL_VERTEX_SHADER),
+                         SHADER(fill_fragment, GL_FRAGMENT_SHADER)}}
+, _composite_program{
+    "composite", {SHADER(composite_vertex, GL_VERTEX_SHADER),
+                  SHADER(composite_fragment, GL_FRAGMENT_SHADER)}}
 , _quad_data{quad_vertices, quad_indices, GL_STATIC_DRAW}
 {
   // Should we have multiple permutation resolutions for different texture
@@ -92,14 +167,29 @@ Renderer::Renderer()
       ARRAY_LENGTH(gen_simplex_permutation_lut), 1,
       gen_simplex_permutation_lut);
   _quad_data.enable_attribute(0, 4, 0, 0);
+
+  GLint alignment = 0;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  _camera_stride = block_stride(sizeof(frame_uniforms), alignment);
+  _world_stride = block_stride(sizeof(draw_uniforms), alignment);
+  for (auto* program : {
+           &_draw_program, &_draw_instanced_program, &_quad_program,
+           &_post_program, &_world_program, &_world_instanced_program,
+           &_outline_program, &_fill_program, &_composite_program}) {
+    program->uniform_block("frame_uniforms", FRAME_BINDING);
+    program->uniform_block("draw_uniforms", DRAW_BINDING);
+    program->texture_unit("simplex_gradient_lut", SIMPLEX_GRADIENT_UNIT);
+    program->texture_unit(
+        "simplex_permutation_lut", SIMPLEX_PERMUTATION_UNIT);
+  }
 }
 
 void Renderer::resize(const glm::ivec2& dimensions)
 {
   _dimensions = dimensions;
-  _vp_transform_dirty = true;
 
   _framebuffer.reset(new GlFramebuffer{dimensions, true, true});
+  _target = _framebuffer.get();
   if (_framebuffer->is_multisampled()) {
     _framebuffer_intermediate.reset(
         new GlFramebuffer{dimensions, false, false});
@@ -108,32 +198,169 @@ void Renderer::resize(const glm::ivec2& dimensions)
   }
 }
 
-void Renderer::perspective(float fov, float z_near, float z_far)
+void Renderer::execute(const FramePacket& packet)
 {
-  _perspective.fov = fov;
-  _perspective.z_near = z_near;
-  _perspective.z_far = z_far;
-  _vp_transform_dirty = true;
+  while (_queries.size() < packet.query_count()) {
+    _queries.emplace_back(new GlQuery);
+  }
+
+  _instance_floats.clear();
+  _instance_floats.reserve(4 * INSTANCE_TEXELS * packet.instances().size());
+  for (const auto& instance : packet.instances()) {
+    auto matrix = instance.transform.matrix();
+    for (uint32_t i = 0; i < 4; ++i) {
+      for (uint32_t j = 0; j < 4; ++j) {
+        _instance_floats.push_back(matrix[i][j]);
+      }
+    }
+    // Unused planes are zero, so they never clip anything.
+    for (uint32_t i = 0; i < MAX_CLIP_PLANES; ++i) {
+      auto plane = i < instance.clip_planes.size() ?
+          instance.clip_planes.plane(i) : glm::vec4{0};
+      for (uint32_t j = 0; j < 4; ++j) {
+        _instance_floats.push_back(plane[j]);
+      }
+    }
+    _instance_floats.push_back(float(instance.stencil_ref));
+    _instance_floats.push_back(0);
+    _instance_floats.push_back(0);
+    _instance_floats.push_back(0);
+  }
+  _instance_data.update(_instance_floats);
+  upload_uniforms(packet);
+  for (const auto* mesh : packet.uploads()) {
+    buffers(*mesh);
+  }
+  for (size_t i = 0; i < packet.commands().size();) {
+    i = execute(packet, i);
+  }
+  for (const auto& mesh : packet.released()) {
+    _meshes.erase(mesh->id());
+  }
+}
+
+size_t Renderer::execute(const FramePacket& packet, size_t first)
+{
+  const auto& commands = packet.commands();
+  for (auto i = first; i < commands.size(); ++i) {
+    const auto& c = commands[i];
+    switch (c.type) {
+    case FramePacket::CAMERA:
+      camera(c.index);
+      break;
+    case FramePacket::WORLD:
+      world(c.index);
+      break;
+    case FramePacket::CLEAR:
+      clear();
+      break;
+    case FramePacket::CLEAR_DEPTH:
+      clear_depth(c.stencil_ref, c.test_mask);
+      break;
+    case FramePacket::CLEAR_STENCIL:
+      clear_stencil(c.write_mask);
+      break;
+    case FramePacket::BEGIN_VIEW: {
+      const auto& view = packet.views()[c.index];
+      begin_view(view.slot, view.dimensions);
+      break;
+    }
+    case FramePacket::END_VIEW:
+      end_view();
+      break;
+    case FramePacket::BEGIN_CONDITION: {
+      auto condition = GlQuery::condition(
+          c.index == FramePacket::NONE ? nullptr : _queries[c.index].get(),
+          GL_QUERY_WAIT);
+      i = execute(packet, 1 + i) - 1;
+      break;
+    }
+    case FramePacket::END_CONDITION:
+      return 1 + i;
+    case FramePacket::STENCIL:
+      stencil(mesh_data(*c.mesh), c.stencil_ref, c.test_mask, c.write_mask,
+              c.depth_eq,
+              c.query == FramePacket::NONE ? nullptr : _queries[c.query].get());
+      break;
+    case FramePacket::DEPTH_INSTANCES:
+      depth_instances(mesh_data(*c.mesh), packet,
+                      packet.instance_ranges()[c.index], c.test_mask);
+      break;
+    case FramePacket::DRAW_INSTANCES:
+      draw_instances(mesh_data(*c.mesh), packet,
+                     packet.instance_ranges()[c.index], c.test_mask);
+      break;
+    case FramePacket::FILL:
+      fill(mesh_data(*c.mesh), c.stencil_ref, c.test_mask);
+      break;
+    case FramePacket::COMPOSITE: {
+      const auto& view = packet.views()[c.index];
+      composite(mesh_data(*c.mesh), view.slot, view.vp_transform,
+                c.stencil_ref, c.test_mask);
+      break;
+    }
+    case FramePacket::DRAW:
+      draw(mesh_data(*c.mesh), c.stencil_ref, c.test_mask);
+      break;
+    case FramePacket::OUTLINE:
+      outline(outline_data(*c.mesh), c.stencil_ref, c.test_mask);
+      break;
+    }
+  }
+  return commands.size();
 }
 
-void Renderer::camera(const glm::vec3& eye, const glm::vec3& target,
-                      const glm::vec3& up)
+void Renderer::upload_uniforms(const FramePacket& packet)
 {
-  _view_transform = glm::lookAt(eye, target, up);
-  _vp_transform_dirty = true;
+  _uniform_index = (1 + _uniform_index) % UNIFORM_BUFFERS;
+  auto& buffers = _uniform_buffers[_uniform_index];
+  auto use_permutation_lut = int32_t(
+      uint32_t(_max_texture_size) >= ARRAY_LENGTH(gen_simplex_permutation_lut));
+  // Outlines are about a pixel either side, at the window's resolution.
+  float outline_width = 2.f / packet.dimensions().y;
+
+  const auto& cameras = packet.cameras();
+  _uniform_data.assign(_camera_stride * cameras.size(), 0);
+  for (size_t i = 0; i < cameras.size(); ++i) {
+    const auto& camera = cameras[i];
+    frame_uniforms u{camera.projection * camera.view_transform,
+                     camera.eye, use_permutation_lut,
+                     camera.eye, camera.z_near,
+                     camera.dir, outline_width,
+                     camera.side, 0, camera.up, 0};
+    std::memcpy(&_uniform_data[i * _camera_stride], &u, sizeof(u));
+  }
+  buffers.cameras.update(_uniform_data);
+
+  const auto& worlds = packet.worlds();
+  _uniform_data.assign(_world_stride * worlds.size(), 0);
+  for (size_t i = 0; i < worlds.size(); ++i) {
+    const auto& world = worlds[i];
+    // Unused planes are zero, so they never clip anything.
+    draw_uniforms u;
+    u.world_transform = world.transform.matrix();
+    for (uint32_t j = 0; j < MAX_CLIP_PLANES; ++j) {
+      u.clip_planes[j] = j < world.clip_planes.size() ?
+          world.clip_planes.plane(j) : glm::vec4{0};
+    }
+    std::memcpy(&_uniform_data[i * _world_stride], &u, sizeof(u));
+  }
+  buffers.worlds.update(_uniform_data);
+
+  _simplex_gradient_lut.bind_unit(SIMPLEX_GRADIENT_UNIT);
+  _simplex_permutation_lut.bind_unit(SIMPLEX_PERMUTATION_UNIT);
 }
 
-void Renderer::world(const glm::mat4& world_transform)
+void Renderer::camera(uint32_t index) const
 {
-  world(world_transform, {});
+  _uniform_buffers[_uniform_index].cameras.bind(
+      FRAME_BINDING, index * _camera_stride, sizeof(frame_uniforms));
 }
 
-void Renderer::world(const glm::mat4& world_transform,
-                     const std::vector<plane>& clip_planes)
+void Renderer::world(uint32_t index) const
 {
-  _world_transform = world_transform;
-  _normal_transform_dirty = true;
-  _clip_planes = clip_planes;
+  _uniform_buffers[_uniform_index].worlds.bind(
+      DRAW_BINDING, index * _world_stride, sizeof(draw_uniforms));
 }
 
 void Renderer::clear() const
@@ -161,159 +388,152 @@ void Renderer::clear_depth(uint32_t stencil_ref, uint32_t stencil_mask) const
   render_settings(/* dtest */ false, /* dmask */ true, /* depth_eq */ false,
                   /* cmask */ false, /* blend */ false);
   stencil_settings(stencil_ref, stencil_mask, 0x00);
+  clipping(false);
 
   auto program = _post_program.use();
-  auto draw = _framebuffer->draw();
+  auto draw = _target->draw();
   _quad_data.draw();
 }
 
 void Renderer::clear_stencil(uint32_t stencil_mask) const
 {
-  auto draw = _framebuffer->draw();
+  auto draw = _target->draw();
   glStencilMask(stencil_mask);
   glClearStencil(0x00);
   glClear(GL_STENCIL_BUFFER_BIT);
 }
 
+void Renderer::begin_view(uint32_t slot, const glm::ivec2& dimensions)
+{
+  glm::ivec2 size{std::min(dimensions.x, _max_texture_size),
+                  std::min(dimensions.y, _max_texture_size)};
+  if (slot >= _views.size()) {
+    _views.resize(1 + slot);
+  }
+  auto& view = _views[slot];
+  if (!view.framebuffer || view.dimensions != size) {
+    // No multisampling, since we need to read it back as a texture.
+    view.framebuffer.reset(new GlFramebuffer{size, true, false});
+    view.dimensions = size;
+  }
+  _target = view.framebuffer.get();
+
+  glViewport(0, 0, size.x, size.y);
+  auto draw = _target->draw();
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDepthMask(GL_TRUE);
+  glStencilMask(0xff);
+  glClearColor(0, 0, 0, 0);
+  glClearDepth(1);
+  glClearStencil(0x00);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+}
+
+void Renderer::end_view()
+{
+  _target = _framebuffer.get();
+  glViewport(0, 0, _dimensions.x, _dimensions.y);
+}
+
 void Renderer::stencil(
     const GlVertexData& data, uint32_t stencil_ref,
-    uint32_t test_mask, uint32_t write_mask, bool depth_eq) const
+    uint32_t test_mask, uint32_t write_mask, bool depth_eq,
+    const GlQuery* query) const
 {
-  compute_transform();
   render_settings(/* dtest */ true, /* dmask */ true, depth_eq,
                   /* cmask */ false, /* blend */ false);
   stencil_settings(stencil_ref, test_mask, write_mask);
+  clipping(true);
 
   auto program = _world_program.use();
-  auto draw = _framebuffer->draw();
-
-  set_mvp_uniforms(program);
-  data.draw();
+  auto draw = _target->draw();
+  if (query) {
+    auto active = query->begin(GL_ANY_SAMPLES_PASSED);
+    data.draw();
+  } else {
+    data.draw();
+  }
 }
 
-void Renderer::depth(const GlVertexData& data, uint32_t stencil_ref,
-                                               uint32_t stencil_mask) const
+void Renderer::depth_instances(
+    const GlVertexData& data, const FramePacket& packet,
+    const FramePacket::instance_range& range, uint32_t stencil_mask) const
 {
-  compute_transform();
   render_settings(/* dtest */ true, /* dmask */ true, /* depth_eq */ false,
                   /* cmask */ false, /* blend */ false);
-  stencil_settings(stencil_ref, stencil_mask, 0x00);
-
-  auto program = _world_program.use();
-  auto draw = _framebuffer->draw();
+  auto program = _world_instanced_program.use();
+  instances(program, data, packet, range, stencil_mask);
+}
 
-  set_mvp_uniforms(program);
-  data.draw();
+void Renderer::draw_instances(
+    const GlVertexData& data, const FramePacket& packet,
+    const FramePacket::instance_range& range, uint32_t stencil_mask) const
+{
+  render_settings(/* dtest */ true, /* dmask */ true, /* depth_eq */ false,
+                  /* cmask */ true, /* blend */ false);
+  auto program = _draw_instanced_program.use();
+  instances(program, data, packet, range, stencil_mask);
 }
 
-void Renderer::draw(const Mesh& mesh, const Player& player,
-                    uint32_t stencil_ref, uint32_t stencil_mask) const
+void Renderer::fill(const GlVertexData& data, uint32_t stencil_ref,
+                    uint32_t stencil_mask) const
 {
-  compute_transform();
   render_settings(/* dtest */ true, /* dmask */ true, /* depth_eq */ false,
                   /* cmask */ true, /* blend */ false);
   stencil_settings(stencil_ref, stencil_mask, 0x00);
+  clipping(true);
 
-  {
-    auto program = _draw_program.use();
-    auto draw = _framebuffer->draw();
-
-    set_simplex_uniforms(program);
-    set_mvp_uniforms(program);
-    glUniformMatrix3fv(program.uniform("normal_transform"),
-                       1, GL_FALSE, glm::value_ptr(_normal_transform));
-    glUniform3fv(program.uniform("light_source"),
-                 1, glm::value_ptr(player.get_head_position()));
+  auto program = _fill_program.use();
+  auto draw = _target->draw();
+  data.draw();
+}
 
-    mesh.visible_data().draw();
+void Renderer::composite(const GlVertexData& data, uint32_t slot,
+                         const glm::mat4& view_vp_transform,
+                         uint32_t stencil_ref, uint32_t stencil_mask) const
+{
+  if (slot >= _views.size() || !_views[slot].framebuffer) {
+    fill(data, stencil_ref, stencil_mask);
+    return;
   }
+  render_settings(/* dtest */ true, /* dmask */ true, /* depth_eq */ false,
+                  /* cmask */ true, /* blend */ false);
+  stencil_settings(stencil_ref, stencil_mask, 0x00);
+  clipping(true);
+
+  auto program = _composite_program.use();
+  auto draw = _target->draw();
+  glUniformMatrix4fv(program.uniform("view_vp_transform"),
+                     1, GL_FALSE, glm::value_ptr(view_vp_transform));
+  program.uniform_texture("view_texture",
+                          _views[slot].framebuffer->texture());
+  data.draw();
+}
 
-  // TODO: this outline code shouldn't really be here. It could also do
-  // visibility calculations.
-  const auto& eye = player.get_head_position();
-  const auto& dir = player.get_look_direction();
-  auto side = side_direction(dir);
-  auto up = up_direction(dir);
-  auto z_near = player.get_z_near();
-  const float outline_width = 2. / _dimensions.y;
-
-  std::vector<float> outline_vertices;
-  std::vector<GLushort> outline_indices;
-  size_t vertex_count = 0;
-  auto add_outline = [&](const glm::vec3& v, const Mesh::outline_data& outline)
-  {
-    outline_vertices.push_back(v.x);
-    outline_vertices.push_back(v.y);
-    outline_vertices.push_back(v.z);
-    outline_vertices.push_back(outline.hue);
-    outline_vertices.push_back(outline.hue_shift);
-  };
-
-  for (const auto& outline : mesh.outlines()) {
-    glm::vec3 a{_world_transform * glm::vec4{outline.a, 1.}};
-    glm::vec3 b{_world_transform * glm::vec4{outline.b, 1.}};
-
-    auto tn = _normal_transform * outline.t_normal;
-    auto un = _normal_transform * outline.u_normal;
-    bool t_front = glm::dot(tn, eye - a) >= 0;
-    bool u_front = glm::dot(un, eye - a) >= 0;
-
-    if (t_front != u_front) {
-      // Clip against near-plane.
-      auto da = glm::dot(a - eye - dir * z_near, dir);
-      auto db = glm::dot(b - eye - dir * z_near, dir);
-      if (da < 0 && db < 0) {
-        continue;
-      } else if (da < 0) {
-        a = b + db / (db - da) * (a - b);
-      } else if (db < 0) {
-        b = a + da / (da - db) * (b - a);
-      }
+void Renderer::draw(const GlVertexData& data,
+                    uint32_t stencil_ref, uint32_t stencil_mask) const
+{
+  render_settings(/* dtest */ true, /* dmask */ true, /* depth_eq */ false,
+                  /* cmask */ true, /* blend */ false);
+  stencil_settings(stencil_ref, stencil_mask, 0x00);
+  clipping(true);
 
-      // Project onto view-plane, work out directions.
-      // TODO: there are still small inconsistencies in line thickness.
-      auto coords_a = view_plane_coords(eye, dir, a);
-      auto coords_b = view_plane_coords(eye, dir, b);
-      auto offset = glm::normalize(coords_b - coords_a);
-      glm::vec2 perp{offset.y, -offset.x};
-
-      auto perp3 = perp.x * side + perp.y * up;
-      auto offset3 = offset.x * side + offset.y * up;
-
-      auto a0 = a + da * outline_width * (-offset3 - perp3);
-      auto a1 = a + da * outline_width * (-offset3 + perp3);
-      auto b0 = b + db * outline_width * (offset3 - perp3);
-      auto b1 = b + db * outline_width * (offset3 + perp3);
-
-      add_outline(a0, outline);
-      add_outline(a1, outline);
-      add_outline(b0, outline);
-      add_outline(b1, outline);
-
-      outline_indices.push_back(GLushort(0 + vertex_count));
-      outline_indices.push_back(GLushort(1 + vertex_count));
-      outline_indices.push_back(GLushort(2 + vertex_count));
-      outline_indices.push_back(GLushort(1 + vertex_count));
-      outline_indices.push_back(GLushort(3 + vertex_count));
-      outline_indices.push_back(GLushort(2 + vertex_count));
-      vertex_count += 4;
-    }
-  }
-  if (outline_indices.empty()) {
-    return;
-  }
+  auto program = _draw_program.use();
+  auto draw = _target->draw();
+  data.draw();
+}
 
-  GlVertexData outline_data{outline_vertices, outline_indices, GL_STREAM_DRAW};
-  outline_data.enable_attribute(0, 3, 5, 0);
-  outline_data.enable_attribute(1, 1, 5, 3);
-  outline_data.enable_attribute(2, 1, 5, 4);
+void Renderer::outline(const GlVertexData& data,
+                       uint32_t stencil_ref, uint32_t stencil_mask) const
+{
+  render_settings(/* dtest */ true, /* dmask */ true, /* depth_eq */ false,
+                  /* cmask */ true, /* blend */ false);
+  stencil_settings(stencil_ref, stencil_mask, 0x00);
+  clipping(true);
 
   auto program = _outline_program.use();
-  auto draw = _framebuffer->draw();
-  set_mvp_uniforms(program);
-  glUniform3fv(program.uniform("light_source"),
-               1, glm::value_ptr(player.get_head_position()));
-  outline_data.draw();
+  auto draw = _target->draw();
+  data.draw();
 }
 
 void Renderer::render() const
@@ -321,6 +541,7 @@ void Renderer::render() const
   stencil_settings(0x00, 0x00, 0x00);
   render_settings(/* dtest */ false, /* dmask */ false, /* depth_eq */ false,
                   /* cmask */ true, /* blend */ false);
+  clipping(false);
 
   glm::vec2 dimensions = _dimensions;
   if (_framebuffer_intermediate) {
@@ -336,7 +557,6 @@ void Renderer::render() const
   auto program = _post_program.use();
   glUniform1f(program.uniform("frame"), _frame);
   glUniform2fv(program.uniform("dimensions"), 1, glm::value_ptr(dimensions));
-  set_simplex_uniforms(program);
 
   const auto& texture = _framebuffer_intermediate ?
       _framebuffer_intermediate->texture() : _framebuffer->texture();
@@ -349,58 +569,88 @@ float Renderer::get_aspect_ratio() const
   return float(_dimensions.x) / _dimensions.y;
 }
 
-void Renderer::compute_transform() const
+const glm::ivec2& Renderer::get_dimensions() const
 {
-  if (_vp_transform_dirty) {
-    auto perspective_transform = glm::perspectiveRH(
-        _perspective.fov, (float)_dimensions.x / _dimensions.y,
-        _perspective.z_near, _perspective.z_far);
+  return _dimensions;
+}
 
-    _vp_transform_dirty = false;
-    _vp_transform = perspective_transform * _view_transform;
-  }
+Renderer::mesh_buffers::mesh_buffers(const Mesh& mesh)
+: visible{mesh.visible_vertices(), mesh.visible_indices(), GL_STATIC_DRAW}
+, outlines{mesh.outline_vertices(), mesh.outline_indices(), GL_STATIC_DRAW,
+           GL_LINES}
+{
+  visible.enable_attribute(0, 3, 8, 0);
+  visible.enable_attribute(1, 3, 8, 3);
+  visible.enable_attribute(2, 1, 8, 6);
+  visible.enable_attribute(3, 1, 8, 7);
+  outlines.enable_attribute(0, 3, 11, 0);
+  outlines.enable_attribute(1, 3, 11, 3);
+  outlines.enable_attribute(2, 3, 11, 6);
+  outlines.enable_attribute(3, 1, 11, 9);
+  outlines.enable_attribute(4, 1, 11, 10);
+}
 
-  if (_normal_transform_dirty) {
-    _normal_transform_dirty = false;
-    _normal_transform =
-        glm::transpose(glm::inverse(glm::mat3{_world_transform}));
+const Renderer::mesh_buffers& Renderer::buffers(const Mesh& mesh)
+{
+  auto& data = _meshes[mesh.id()];
+  if (!data) {
+    data.reset(new mesh_buffers{mesh});
   }
+  return *data;
 }
 
-void Renderer::set_mvp_uniforms(const GlActiveProgram& program) const
+const GlVertexData& Renderer::mesh_data(const Mesh& mesh)
 {
-  glUniformMatrix4fv(program.uniform("world_transform"),
-                     1, GL_FALSE, glm::value_ptr(_world_transform));
-  glUniformMatrix4fv(program.uniform("vp_transform"),
-                     1, GL_FALSE, glm::value_ptr(_vp_transform));
-
-  static const uint32_t max_clip_distances = 8;
-  for (uint32_t i = 0; i < max_clip_distances; ++i) {
-    if (i < _clip_planes.size()) {
+  return buffers(mesh).visible;
+}
+
+const GlVertexData& Renderer::outline_data(const Mesh& mesh)
+{
+  return buffers(mesh).outlines;
+}
+
+void Renderer::clipping(bool enabled) const
+{
+  // Unused planes are zero, so they can be left on for anything in a world.
+  if (enabled == _clipping) {
+    return;
+  }
+  _clipping = enabled;
+  for (uint32_t i = 0; i < MAX_CLIP_PLANES; ++i) {
+    if (enabled) {
       glEnable(i + GL_CLIP_DISTANCE0);
     } else {
       glDisable(i + GL_CLIP_DISTANCE0);
     }
   }
-
-  std::vector<glm::vec3> points;
-  std::vector<glm::vec3> normals;
-  for (const auto& pair : _clip_planes) {
-    points.push_back(pair.first);
-    normals.push_back(pair.second);
-  }
-  glUniform3fv(program.uniform("clip_points"),
-               points.size(), glm::value_ptr(*points.data()));
-  glUniform3fv(program.uniform("clip_normals"),
-               normals.size(), glm::value_ptr(*normals.data()));
 }
 
-void Renderer::set_simplex_uniforms(const GlActiveProgram& program) const
+void Renderer::instances(
+    const GlActiveProgram& program, const GlVertexData& data,
+    const FramePacket& packet, const FramePacket::instance_range& range,
+    uint32_t stencil_mask) const
 {
-  glUniform1i(
-      program.uniform("simplex_use_permutation_lut"),
-      uint32_t(_max_texture_size) >= ARRAY_LENGTH(gen_simplex_permutation_lut));
-
-  program.uniform_texture("simplex_gradient_lut", _simplex_gradient_lut);
-  program.uniform_texture("simplex_permutation_lut", _simplex_permutation_lut);
+  clipping(true);
+  auto draw = _target->draw();
+  program.uniform_texture("instances", _instance_data);
+
+  auto first_instance = program.uniform("first_instance");
+  if (_stencil_export) {
+    // The ref given here is replaced by each instance's own.
+    stencil_settings(0, stencil_mask, 0x00);
+    glUniform1i(first_instance, range.first_instance);
+    data.draw_instanced(range.instance_count);
+    return;
+  }
+  // Drawn one by one, so hidden instances can be skipped after all.
+  for (uint32_t i = 0; i < range.instance_count; ++i) {
+    auto index = range.first_instance + i;
+    const auto& instance = packet.instances()[index];
+    auto condition = GlQuery::condition(
+        instance.query == FramePacket::NONE ?
+            nullptr : _queries[instance.query].get(), GL_QUERY_WAIT);
+    stencil_settings(instance.stencil_ref, stencil_mask, 0x00);
+    glUniform1i(first_instance, index);
+    data.draw_instanced(1);
+  }
 }
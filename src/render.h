@@ -1,90 +1,148 @@
 #ifndef MOBIUS_RENDER_H
 #define MOBIUS_RENDER_H
 
+#include "frame_packet.h"
 #include "glo.h"
 #include <glm/vec2.hpp>
-#include <glm/vec3.hpp>
-#include <glm/mat3x3.hpp>
 #include <glm/mat4x4.hpp>
 #include <cstdint>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 class Mesh;
-class Player;
-
+// Plays back frame packets. Everything here has to be done on the thread
+// that owns the GL context.
 class Renderer {
 public:
   Renderer();
 
-  typedef std::pair<glm::vec3, glm::vec3> plane;
   void resize(const glm::ivec2& dimensions);
-  void perspective(float fov, float z_near, float z_far);
-  void camera(const glm::vec3& eye, const glm::vec3& target,
-              const glm::vec3& up);
-  void world(const glm::mat4& world_transform);
-  void world(const glm::mat4& world_transform,
-             const std::vector<plane>& clip_planes);
+  void execute(const FramePacket& packet);
+  void render() const;
+
+  float get_aspect_ratio() const;
+  const glm::ivec2& get_dimensions() const;
+
+private:
+  // Returns the index of the command after the end of the condition, if
+  // there was one.
+  size_t execute(const FramePacket& packet, size_t first);
+
+  // Uniforms for every camera and world in the packet are uploaded before
+  // it's played, so these just pick which ones the shaders see.
+  void upload_uniforms(const FramePacket& packet);
+  void camera(uint32_t index) const;
+  void world(uint32_t index) const;
 
   void clear() const;
   void clear_depth(uint32_t stencil_ref, uint32_t stencil_mask) const;
   void clear_stencil(uint32_t stencil_mask) const;
 
+  // Redirects drawing to an offscreen view, which is kept until the next call
+  // with the same slot. Each view has its own depth and stencil.
+  void begin_view(uint32_t slot, const glm::ivec2& dimensions);
+  void end_view();
+
   void stencil(const GlVertexData& data, uint32_t stencil_ref,
-               uint32_t test_mask, uint32_t write_mask, bool depth_eq) const;
-  void depth(const GlVertexData& data, uint32_t stencil_ref,
-                                       uint32_t stencil_mask) const;
-  void draw(const Mesh& mesh, const Player& player,
+               uint32_t test_mask, uint32_t write_mask, bool depth_eq,
+               const GlQuery* query = nullptr) const;
+  // Instances each have a transform, clip planes and stencil ref of their
+  // own. With stencil export, the whole range is one draw; otherwise it's one
+  // per instance, but without setting any uniforms in between.
+  void depth_instances(const GlVertexData& data, const FramePacket& packet,
+                       const FramePacket::instance_range& range,
+                       uint32_t stencil_mask) const;
+  void draw_instances(const GlVertexData& data, const FramePacket& packet,
+                      const FramePacket::instance_range& range,
+                      uint32_t stencil_mask) const;
+  // Draws the shape in a flat background colour.
+  void fill(const GlVertexData& data, uint32_t stencil_ref,
+            uint32_t stencil_mask) const;
+  // Draws the shape textured with an offscreen view, projected with the
+  // transform that was used to render it.
+  void composite(const GlVertexData& data, uint32_t slot,
+                 const glm::mat4& view_vp_transform,
+                 uint32_t stencil_ref, uint32_t stencil_mask) const;
+  void draw(const GlVertexData& data,
             uint32_t stencil_ref, uint32_t stencil_mask) const;
-  void render() const;
-
-  float get_aspect_ratio() const;
-
-private:
-  void compute_transform() const;
-  // We should really avoid setting uniforms that haven't changed. Maybe using
-  // uniform buffers?
-  void set_mvp_uniforms(const GlActiveProgram& program) const;
-  void set_simplex_uniforms(const GlActiveProgram& program) const;
+  // Draws the mesh's edges that are outlines as seen from the camera. Which
+  // those are, and how wide, is worked out in a geometry shader.
+  void outline(const GlVertexData& data,
+               uint32_t stencil_ref, uint32_t stencil_mask) const;
+
+  // The mesh's GPU copies, uploaded the first time it's drawn.
+  struct mesh_buffers {
+    mesh_buffers(const Mesh& mesh);
+    GlVertexData visible;
+    GlVertexData outlines;
+  };
+  const mesh_buffers& buffers(const Mesh& mesh);
+  const GlVertexData& mesh_data(const Mesh& mesh);
+  const GlVertexData& outline_data(const Mesh& mesh);
+
+  // Turns the clip distances on or off, if they aren't already.
+  void clipping(bool enabled) const;
+  void instances(const GlActiveProgram& program, const GlVertexData& data,
+                 const FramePacket& packet,
+                 const FramePacket::instance_range& range,
+                 uint32_t stencil_mask) const;
 
   GlInit _gl_init;
+  // Whether shaders can set their own stencil ref.
+  bool _stencil_export;
   std::unique_ptr<GlFramebuffer> _framebuffer;
   std::unique_ptr<GlFramebuffer> _framebuffer_intermediate;
+  // Whichever framebuffer is being drawn to.
+  const GlFramebuffer* _target = nullptr;
+
+  struct view {
+    glm::ivec2 dimensions;
+    std::unique_ptr<GlFramebuffer> framebuffer;
+  };
+  std::vector<view> _views;
 
   GlProgram _draw_program;
+  GlProgram _draw_instanced_program;
   GlProgram _quad_program;
   GlProgram _post_program;
   GlProgram _world_program;
+  GlProgram _world_instanced_program;
   GlProgram _outline_program;
+  GlProgram _fill_program;
+  GlProgram _composite_program;
 
   GlTexture _simplex_gradient_lut;
   GlTexture _simplex_permutation_lut;
 
   int32_t _max_texture_size = 0;
   mutable uint32_t _frame = 0;
+  // Occlusion queries are recycled each frame.
+  std::vector<std::unique_ptr<GlQuery>> _queries;
   GlVertexData _quad_data;
+  // The frame's instances, four floats to a texel.
+  GlBufferTexture _instance_data;
+  std::vector<GLfloat> _instance_floats;
+  // Keyed by mesh id, and kept until the mesh is released.
+  std::unordered_map<uint64_t, std::unique_ptr<mesh_buffers>> _meshes;
+
+  // Uniform blocks for each camera and world of the packet. The buffers are
+  // cycled, so that a frame doesn't have to wait for the last one to finish
+  // reading them.
+  struct uniform_buffers {
+    GlUniformBuffer cameras;
+    GlUniformBuffer worlds;
+  };
+  static const uint32_t UNIFORM_BUFFERS = 3;
+  uniform_buffers _uniform_buffers[UNIFORM_BUFFERS];
+  uint32_t _uniform_index = 0;
+  // Blocks are laid out this far apart.
+  size_t _camera_stride = 0;
+  size_t _world_stride = 0;
+  std::vector<char> _uniform_data;
+  mutable bool _clipping = false;
 
-  // For perspective (camera space to clip space) transform.
   glm::ivec2 _dimensions;
-  struct {
-    float fov = 0;
-    float z_near = 0;
-    float z_far = 0;
-  } _perspective;
-
-  // For view (world space to camera space) transform.
-  glm::mat4 _view_transform;
-
-  // For world (model space to world space) transform.
-  glm::mat4 _world_transform;
-
-  // For custom clipping.
-  std::vector<plane> _clip_planes;
-
-  mutable glm::mat4 _vp_transform;
-  mutable glm::mat3 _normal_transform;
-  mutable bool _vp_transform_dirty = false;
-  mutable bool _normal_transform_dirty = false;
 };
 
 #endif
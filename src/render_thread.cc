@@ -0,0 +1,85 @@
+#include "render_thread.h"
+#include "render.h"
+#include <SFML/Graphics.hpp>
+
+RenderThread::RenderThread(sf::RenderWindow& window, Renderer& renderer,
+                           const std::string& font_path)
+: _window(window)
+, _renderer(renderer)
+, _font_path{font_path}
+, _thread{&RenderThread::run, this}
+{
+}
+
+RenderThread::~RenderThread()
+{
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _running = false;
+  }
+  _condition.notify_all();
+  _thread.join();
+  // Whatever's destroyed next still needs the context.
+  _window.setActive(true);
+}
+
+FramePacket& RenderThread::begin_frame()
+{
+  std::unique_lock<std::mutex> lock{_mutex};
+  _condition.wait(lock, [&]{ return !_pending[_building]; });
+  return _packets[_building];
+}
+
+void RenderThread::end_frame()
+{
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _pending[_building] = true;
+    _building = 1 - _building;
+  }
+  _condition.notify_all();
+}
+
+void RenderThread::run()
+{
+  _window.setActive(true);
+  sf::Font font;
+  font.loadFromFile(_font_path);
+  sf::Text debug_text{"", font, 24};
+  debug_text.setColor(sf::Color::Black);
+  debug_text.setPosition(sf::Vector2f{8, 8});
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{_mutex};
+      _condition.wait(lock, [&]{ return !_running || _pending[_rendering]; });
+      if (!_pending[_rendering]) {
+        break;
+      }
+    }
+
+    // The packet isn't touched by the main thread until it's given back.
+    const auto& packet = _packets[_rendering];
+    const auto& size = packet.dimensions();
+    if (size != _renderer.get_dimensions()) {
+      _renderer.resize(size);
+      _window.setView(sf::View{sf::Vector2f(size.x / 2, size.y / 2),
+                               sf::Vector2f(size.x, size.y)});
+    }
+    _renderer.execute(packet);
+    _renderer.render();
+
+    debug_text.setString(packet.debug_text);
+    _window.resetGLStates();
+    _window.draw(debug_text);
+    _window.display();
+
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _pending[_rendering] = false;
+      _rendering = 1 - _rendering;
+    }
+    _condition.notify_all();
+  }
+  _window.setActive(false);
+}
@@ -0,0 +1,48 @@
+#ifndef MOBIUS_RENDER_THREAD_H
+#define MOBIUS_RENDER_THREAD_H
+
+#include "frame_packet.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace sf {
+  class RenderWindow;
+}
+class Renderer;
+// Owns the GL context, and plays back frame packets on a thread of its own.
+// There are two packets, so that the next frame can be built while the last
+// one is being rendered.
+class RenderThread {
+public:
+  // The window's context mustn't be active on any other thread.
+  RenderThread(sf::RenderWindow& window, Renderer& renderer,
+               const std::string& font_path);
+  ~RenderThread();
+
+  // Returns the packet to build the next frame into, waiting until the render
+  // thread has finished with it.
+  FramePacket& begin_frame();
+  // Hands the packet over to be rendered.
+  void end_frame();
+
+private:
+  void run();
+
+  sf::RenderWindow& _window;
+  Renderer& _renderer;
+  std::string _font_path;
+
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  FramePacket _packets[2];
+  bool _pending[2] = {false, false};
+  // Packet being built, and packet to render next.
+  uint32_t _building = 0;
+  uint32_t _rendering = 0;
+  bool _running = true;
+  std::thread _thread;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "residency.h"
+
+Residency::Residency(const config& config)
+: _config(config)
+{
+}
+
+void Residency::reset(const std::vector<std::vector<uint32_t>>& neighbours)
+{
+  _neighbours = neighbours;
+  _chunks.assign(neighbours.size(), state{});
+  _frame = 0;
+  _loading_count = 0;
+  _loaded_count = 0;
+  _cpu_used = 0;
+  _gpu_used = 0;
+}
+
+const Residency::config& Residency::get_config() const
+{
+  return _config;
+}
+
+void Residency::update(const uint32_t* roots, size_t root_count,
+                       std::vector<uint32_t>& to_load)
+{
+  ++_frame;
+  for (auto& s : _chunks) {
+    s.wanted = false;
+    s.hops = NONE;
+  }
+
+  // Breadth-first, so that nearer chunks are loaded first.
+  _queue.clear();
+  for (size_t i = 0; i < root_count; ++i) {
+    auto& s = _chunks[roots[i]];
+    if (s.hops == NONE) {
+      s.hops = 0;
+      _queue.push_back(roots[i]);
+    }
+  }
+  for (size_t i = 0; i < _queue.size(); ++i) {
+    auto chunk = _queue[i];
+    auto& s = _chunks[chunk];
+    s.wanted = true;
+    if (s.hops >= _config.hops) {
+      continue;
+    }
+    for (auto neighbour : _neighbours[chunk]) {
+      auto& n = _chunks[neighbour];
+      if (n.hops == NONE) {
+        n.hops = 1 + s.hops;
+        _queue.push_back(neighbour);
+      }
+    }
+  }
+
+  // Things seen last frame come after everything nearby.
+  for (uint32_t i = 0; i < _chunks.size(); ++i) {
+    auto& s = _chunks[i];
+    if (s.requested && !s.wanted) {
+      s.wanted = true;
+      _queue.push_back(i);
+    }
+    s.requested = false;
+  }
+
+  to_load.clear();
+  for (auto chunk : _queue) {
+    if (!_chunks[chunk].loaded && !_chunks[chunk].loading) {
+      to_load.push_back(chunk);
+    }
+  }
+}
+
+void Residency::touch(uint32_t chunk)
+{
+  auto& s = _chunks[chunk];
+  s.last_used = _frame;
+  if (!s.loaded) {
+    s.requested = true;
+  }
+}
+
+void Residency::set_loading(uint32_t chunk)
+{
+  auto& s = _chunks[chunk];
+  if (!s.loaded && !s.loading) {
+    s.loading = true;
+    ++_loading_count;
+  }
+}
+
+void Residency::set_loaded(uint32_t chunk, size_t cpu_bytes, size_t gpu_bytes)
+{
+  auto& s = _chunks[chunk];
+  if (s.loading) {
+    s.loading = false;
+    --_loading_count;
+  }
+  if (s.loaded) {
+    return;
+  }
+  s.loaded = true;
+  s.last_used = _frame;
+  s.cpu_bytes = cpu_bytes;
+  s.gpu_bytes = gpu_bytes;
+  ++_loaded_count;
+  _cpu_used += cpu_bytes;
+  _gpu_used += gpu_bytes;
+}
+
+void Residency::set_unloaded(uint32_t chunk)
+{
+  auto& s = _chunks[chunk];
+  if (!s.loaded) {
+    return;
+  }
+  s.loaded = false;
+  --_loaded_count;
+  _cpu_used -= s.cpu_bytes;
+  _gpu_used -= s.gpu_bytes;
+}
+
+bool Residency::is_loading(uint32_t chunk) const
+{
+  return _chunks[chunk].loading;
+}
+
+bool Residency::is_loaded(uint32_t chunk) const
+{
+  return _chunks[chunk].loaded;
+}
+
+uint32_t Residency::next_eviction() const
+{
+  if (_cpu_used <= _config.cpu_budget && _gpu_used <= _config.gpu_budget) {
+    return NONE;
+  }
+  // Anything used this frame might still be drawn.
+  uint32_t result = NONE;
+  for (uint32_t i = 0; i < _chunks.size(); ++i) {
+    const auto& s = _chunks[i];
+    if (s.loaded && !s.wanted && s.last_used < _frame &&
+        (result == NONE || s.last_used < _chunks[result].last_used)) {
+      result = i;
+    }
+  }
+  return result;
+}
+
+uint32_t Residency::loading_count() const
+{
+  return _loading_count;
+}
+
+uint32_t Residency::loaded_count() const
+{
+  return _loaded_count;
+}
+
+size_t Residency::cpu_used() const
+{
+  return _cpu_used;
+}
+
+size_t Residency::gpu_used() const
+{
+  return _gpu_used;
+}
@@ -0,0 +1,85 @@
+#ifndef MOBIUS_RESIDENCY_H
+#define MOBIUS_RESIDENCY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Decides which chunks should be loaded. Chunks within some number of portal
+// hops of the roots (the active chunk, and any the player is about to walk
+// into) are always wanted, and so is anything that was seen but wasn't
+// loaded. Everything else that's loaded is kept until the memory budget runs
+// out, with the least recently used going first.
+//
+// The budget is soft: wanted chunks are loaded even if they don't fit.
+class Residency {
+public:
+  static const uint32_t NONE = 0xffffffff;
+
+  // Hops should be at least one, so that the simulation has whatever's on the
+  // far side of nearby portals to collide with.
+  struct config {
+    uint32_t hops = 2;
+    size_t cpu_budget = size_t(256) << 20;
+    size_t gpu_budget = size_t(256) << 20;
+    // Chunks being loaded at once.
+    uint32_t max_loads = 4;
+  };
+
+  Residency(const config& config);
+
+  // Starts again with the given chunks (none of them loaded), and the chunks
+  // that can be reached through portals from each.
+  void reset(const std::vector<std::vector<uint32_t>>& neighbours);
+
+  const config& get_config() const;
+
+  // Starts a new frame, and fills in the wanted chunks that aren't loaded (or
+  // being loaded), nearest first.
+  void update(const uint32_t* roots, size_t root_count,
+              std::vector<uint32_t>& to_load);
+  // Marks the chunk as used in this frame. If it isn't loaded, it will be
+  // wanted next frame.
+  void touch(uint32_t chunk);
+
+  void set_loading(uint32_t chunk);
+  void set_loaded(uint32_t chunk, size_t cpu_bytes, size_t gpu_bytes);
+  void set_unloaded(uint32_t chunk);
+  bool is_loading(uint32_t chunk) const;
+  bool is_loaded(uint32_t chunk) const;
+
+  // The least recently used chunk that could be unloaded to get back under
+  // budget, or NONE if there's no need (or nothing suitable).
+  uint32_t next_eviction() const;
+
+  uint32_t loading_count() const;
+  uint32_t loaded_count() const;
+  size_t cpu_used() const;
+  size_t gpu_used() const;
+
+private:
+  struct state {
+    bool loaded = false;
+    bool loading = false;
+    bool wanted = false;
+    bool requested = false;
+    uint32_t hops = NONE;
+    uint64_t last_used = 0;
+    size_t cpu_bytes = 0;
+    size_t gpu_bytes = 0;
+  };
+
+  config _config;
+  std::vector<std::vector<uint32_t>> _neighbours;
+  std::vector<state> _chunks;
+  // Scratch for the search.
+  std::vector<uint32_t> _queue;
+
+  uint64_t _frame = 0;
+  uint32_t _loading_count = 0;
+  uint32_t _loaded_count = 0;
+  size_t _cpu_used = 0;
+  size_t _gpu_used = 0;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef MOBIUS_RIGID_TRANSFORM_H
+#define MOBIUS_RIGID_TRANSFORM_H
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// A rotation followed by a translation. Every transform through a portal is
+// one of these, and composing or inverting them is much cheaper (and more
+// exact) than for general matrices. Matrices are only needed for uploading
+// to the GPU.
+struct RigidTransform {
+  glm::quat rotation;
+  glm::vec3 translation;
+
+  RigidTransform()
+  : rotation{1, 0, 0, 0}
+  , translation{0, 0, 0}
+  {
+  }
+
+  RigidTransform(const glm::quat& rotation, const glm::vec3& translation)
+  : rotation{rotation}
+  , translation{translation}
+  {
+  }
+
+  explicit RigidTransform(const glm::vec3& translation)
+  : rotation{1, 0, 0, 0}
+  , translation{translation}
+  {
+  }
+
+  // The matrix is assumed to be rigid; any scale or shear is lost.
+  static RigidTransform from_matrix(const glm::mat4& matrix)
+  {
+    return {glm::normalize(glm::quat_cast(glm::mat3{matrix})),
+            glm::vec3{matrix[3]}};
+  }
+
+  glm::mat4 matrix() const
+  {
+    auto result = glm::mat4_cast(rotation);
+    result[3] = glm::vec4{translation, 1};
+    return result;
+  }
+
+  glm::vec3 point(const glm::vec3& v) const
+  {
+    return rotation * v + translation;
+  }
+
+  // Directions and normals transform the same way, since there's no scale.
+  glm::vec3 vector(const glm::vec3& v) const
+  {
+    return rotation * v;
+  }
+
+  RigidTransform inverse() const
+  {
+    auto inverse_rotation = glm::conjugate(rotation);
+    return {inverse_rotation, -(inverse_rotation * translation)};
+  }
+
+  // Rounding slowly takes the rotation away from unit length, so anything
+  // built up from a long chain of transforms should be normalized every so
+  // often.
+  RigidTransform normalized() const
+  {
+    return {glm::normalize(rotation), translation};
+  }
+
+  bool operator==(const RigidTransform& t) const
+  {
+    return rotation == t.rotation && translation == t.translation;
+  }
+
+  bool operator!=(const RigidTransform& t) const
+  {
+    return !(*this == t);
+  }
+};
+
+// Applies b, then a.
+inline RigidTransform operator*(const RigidTransform& a,
+                                const RigidTransform& b)
+{
+  return {a.rotation * b.rotation, a.point(b.translation)};
+}
+
+#endif
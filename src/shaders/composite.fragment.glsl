@@ -0,0 +1,11 @@
+smooth in vec4 vertex_view;
+
+out vec4 output_colour;
+
+uniform sampler2D view_texture;
+
+void main()
+{
+  vec2 coords = vertex_view.xy / vertex_view.w;
+  output_colour = texture(view_texture, (coords + 1.) / 2.);
+}
@@ -0,0 +1,22 @@
+#include "uniforms.glsl.h"
+
+layout(location = 0) in vec3 model;
+
+smooth out vec4 vertex_view;
+
+uniform mat4 view_vp_transform;
+
+void main()
+{
+  vec4 world = world_transform * vec4(model, 1.);
+  vec4 clip = vp_transform * world;
+  gl_Position = clip;
+
+  // Where the point was when the view was rendered.
+  vertex_view = view_vp_transform * world;
+
+  // Custom clipping planes.
+  for (int i = 0; i < 8; ++i) {
+    gl_ClipDistance[i] = dot(clip_planes[i], vec4(world.xyz, 1.));
+  }
+}
@@ -0,0 +1,11 @@
+#include "draw.glsl.h"
+
+flat in int vertex_stencil_ref;
+
+out vec4 output_colour;
+
+void main()
+{
+  output_colour = draw_colour();
+  STENCIL_EXPORT(vertex_stencil_ref);
+}
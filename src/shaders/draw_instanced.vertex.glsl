@@ -0,0 +1,33 @@
+#include "instance.glsl.h"
+#include "uniforms.glsl.h"
+
+layout(location = 0) in vec3 model;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in float hue;
+layout(location = 3) in float hue_shift;
+
+smooth out vec3 vertex_world;
+flat out vec3 vertex_normal;
+flat out float vertex_hue;
+flat out float vertex_hue_shift;
+flat out int vertex_stencil_ref;
+
+void main()
+{
+  // The transform is rigid, so normals only need rotating.
+  mat4 world_transform = instance_world_transform();
+  vec3 world_normal = mat3(world_transform) * normal;
+  vec4 world = world_transform * vec4(model, 1.);
+  gl_Position = vp_transform * world;
+
+  vertex_world = world.xyz;
+  vertex_normal = normalize(world_normal);
+  vertex_hue = hue;
+  vertex_hue_shift = hue_shift;
+  vertex_stencil_ref = instance_stencil_ref();
+
+  // Custom clipping planes.
+  for (int i = 0; i < 8; ++i) {
+    gl_ClipDistance[i] = dot(instance_clip_plane(i), vec4(world.xyz, 1.));
+  }
+}
@@ -0,0 +1,7 @@
+out vec4 output_colour;
+
+void main()
+{
+  // Same as the cleared background.
+  output_colour = vec4(0., 0., 0., 1.);
+}
@@ -0,0 +1,27 @@
+// The frame's instances, each taking up 13 texels: its world transform (by
+// column), clip planes, and stencil ref.
+uniform samplerBuffer instances;
+uniform int first_instance;
+
+int instance_texel()
+{
+  return 13 * (first_instance + gl_InstanceID);
+}
+
+mat4 instance_world_transform()
+{
+  int i = instance_texel();
+  return mat4(texelFetch(instances, i), texelFetch(instances, i + 1),
+              texelFetch(instances, i + 2), texelFetch(instances, i + 3));
+}
+
+// Plane normal in xyz, offset in w.
+vec4 instance_clip_plane(int plane)
+{
+  return texelFetch(instances, instance_texel() + 4 + plane);
+}
+
+int instance_stencil_ref()
+{
+  return int(texelFetch(instances, instance_texel() + 12).x);
+}
@@ -1,12 +1,11 @@
 #include "gamma.glsl.h"
+#include "uniforms.glsl.h"
 smooth in vec3 vertex_world;
 flat in float vertex_hue;
 flat in float vertex_hue_shift;
 
 out vec4 output_colour;
 
-uniform vec3 light_source;
-
 void main()
 {
   vec3 light_difference = light_source - vertex_world;
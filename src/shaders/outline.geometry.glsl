@@ -0,0 +1,72 @@
+#include "uniforms.glsl.h"
+
+// Turns each edge between a face towards the camera and one facing away into
+// a quad of roughly constant width on screen.
+layout(lines) in;
+layout(triangle_strip, max_vertices = 4) out;
+
+in vec3 edge_world[];
+in vec3 edge_t_normal[];
+in vec3 edge_u_normal[];
+in float edge_hue[];
+in float edge_hue_shift[];
+
+smooth out vec3 vertex_world;
+flat out float vertex_hue;
+flat out float vertex_hue_shift;
+
+vec2 view_plane_coords(vec3 v)
+{
+  vec3 relative = v - eye;
+  float depth = dot(relative, dir);
+  return vec2(dot(relative, side), dot(relative, up)) / depth;
+}
+
+void emit(vec3 world)
+{
+  gl_Position = vp_transform * vec4(world, 1.);
+  vertex_world = world;
+  vertex_hue = edge_hue[0];
+  vertex_hue_shift = edge_hue_shift[0];
+
+  // Custom clipping planes.
+  for (int i = 0; i < 8; ++i) {
+    gl_ClipDistance[i] = dot(clip_planes[i], vec4(world, 1.));
+  }
+  EmitVertex();
+}
+
+void main()
+{
+  vec3 a = edge_world[0];
+  vec3 b = edge_world[1];
+  bool t_front = dot(edge_t_normal[0], eye - a) >= 0.;
+  bool u_front = dot(edge_u_normal[0], eye - a) >= 0.;
+  if (t_front == u_front) {
+    return;
+  }
+
+  // Clip against near-plane.
+  float da = dot(a - eye - dir * z_near, dir);
+  float db = dot(b - eye - dir * z_near, dir);
+  if (da < 0. && db < 0.) {
+    return;
+  } else if (da < 0.) {
+    a = b + db / (db - da) * (a - b);
+  } else if (db < 0.) {
+    b = a + da / (da - db) * (b - a);
+  }
+
+  // Project onto view-plane, work out directions.
+  vec2 offset = normalize(view_plane_coords(b) - view_plane_coords(a));
+  vec2 perp = vec2(offset.y, -offset.x);
+
+  vec3 perp3 = perp.x * side + perp.y * up;
+  vec3 offset3 = offset.x * side + offset.y * up;
+
+  emit(a + da * outline_width * (-offset3 - perp3));
+  emit(a + da * outline_width * (-offset3 + perp3));
+  emit(b + db * outline_width * (offset3 - perp3));
+  emit(b + db * outline_width * (offset3 + perp3));
+  EndPrimitive();
+}
@@ -1,28 +1,23 @@
-layout(location = 0) in vec3 world;
-layout(location = 1) in float hue;
-layout(location = 2) in float hue_shift;
+#include "uniforms.glsl.h"
 
-smooth out vec3 vertex_world;
-flat out float vertex_hue;
-flat out float vertex_hue_shift;
+layout(location = 0) in vec3 model;
+layout(location = 1) in vec3 t_normal;
+layout(location = 2) in vec3 u_normal;
+layout(location = 3) in float hue;
+layout(location = 4) in float hue_shift;
 
-uniform mat4 world_transform;
-uniform mat4 vp_transform;
-
-uniform vec3 clip_points[8];
-uniform vec3 clip_normals[8];
+out vec3 edge_world;
+out vec3 edge_t_normal;
+out vec3 edge_u_normal;
+out float edge_hue;
+out float edge_hue_shift;
 
 void main()
 {
-  vec4 clip = vp_transform * vec4(world, 1.);
-  gl_Position = clip;
-
-  vertex_world = world;
-  vertex_hue = hue;
-  vertex_hue_shift = hue_shift;
-
-  // Custom clipping planes.
-  for (int i = 0; i < 8; ++i) {
-    gl_ClipDistance[i] = dot(clip_normals[i], world.xyz - clip_points[i]);
-  }
+  // The transform is rigid, so normals only need rotating.
+  edge_world = vec3(world_transform * vec4(model, 1.));
+  edge_t_normal = mat3(world_transform) * t_normal;
+  edge_u_normal = mat3(world_transform) * u_normal;
+  edge_hue = hue;
+  edge_hue_shift = hue_shift;
 }
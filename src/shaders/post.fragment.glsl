@@ -1,6 +1,7 @@
 #include "gamma.glsl.h"
 #include "simplex.glsl.h"
 #include "hsv.glsl.h"
+#include "uniforms.glsl.h"
 
 out vec4 output_colour;
 
@@ -9,7 +10,6 @@ uniform vec2 dimensions;
 uniform sampler2D read_framebuffer;
 uniform sampler1D simplex_gradient_lut;
 uniform sampler1D simplex_permutation_lut;
-uniform bool simplex_use_permutation_lut;
 
 // [0, 1].
 const float grain_amount = 1. / 24;
@@ -0,0 +1,7 @@
+flat in int vertex_stencil_ref;
+
+void main()
+{
+  // Nothing to draw, but the stencil ref might have to come from here.
+  STENCIL_EXPORT(vertex_stencil_ref);
+}
@@ -0,0 +1,21 @@
+// Set for each camera, and shared by every program.
+layout(std140) uniform frame_uniforms {
+  mat4 vp_transform;
+  vec3 light_source;
+  bool simplex_use_permutation_lut;
+  // The camera's basis, for outlines (see outline.geometry.glsl).
+  vec3 eye;
+  float z_near;
+  vec3 dir;
+  // How far outlines reach either side of their edge, on the view plane.
+  float outline_width;
+  vec3 side;
+  vec3 up;
+};
+
+// Set for each world drawn in.
+layout(std140) uniform draw_uniforms {
+  mat4 world_transform;
+  // Plane normal in xyz, offset in w.
+  vec4 clip_planes[8];
+};
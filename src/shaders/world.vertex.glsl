@@ -1,10 +1,6 @@
-layout(location = 0) in vec3 model;
-
-uniform mat4 world_transform;
-uniform mat4 vp_transform;
+#include "uniforms.glsl.h"
 
-uniform vec3 clip_points[8];
-uniform vec3 clip_normals[8];
+layout(location = 0) in vec3 model;
 
 void main()
 {
@@ -14,6 +10,6 @@ void main()
 
   // Custom clipping planes.
   for (int i = 0; i < 8; ++i) {
-    gl_ClipDistance[i] = dot(clip_normals[i], world.xyz - clip_points[i]);
+    gl_ClipDistance[i] = dot(clip_planes[i], vec4(world.xyz, 1.));
   }
 }
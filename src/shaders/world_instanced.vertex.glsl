@@ -0,0 +1,18 @@
+#include "instance.glsl.h"
+#include "uniforms.glsl.h"
+
+layout(location = 0) in vec3 model;
+
+flat out int vertex_stencil_ref;
+
+void main()
+{
+  vec4 world = instance_world_transform() * vec4(model, 1.);
+  gl_Position = vp_transform * world;
+  vertex_stencil_ref = instance_stencil_ref();
+
+  // Custom clipping planes.
+  for (int i = 0; i < 8; ++i) {
+    gl_ClipDistance[i] = dot(instance_clip_plane(i), vec4(world.xyz, 1.));
+  }
+}
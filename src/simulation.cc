@@ -0,0 +1,72 @@
+#include "simulation.h"
+#include "world.h"
+
+namespace {
+  const std::chrono::steady_clock::duration& tick_duration()
+  {
+    static const auto duration =
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::seconds{1}) / Simulation::TICKS_PER_SECOND;
+    return duration;
+  }
+}
+
+Simulation::Simulation(World& world)
+: _world(world)
+, _start{clock::now()}
+, _running{true}
+, _thread{&Simulation::run, this}
+{
+}
+
+Simulation::~Simulation()
+{
+  _running = false;
+  _thread.join();
+}
+
+void Simulation::set_controls(const ControlData& controls)
+{
+  std::lock_guard<std::mutex> lock{_mutex};
+  auto mouse_move = _controls.mouse_move + controls.mouse_move;
+  auto jump = _controls.jump || controls.jump;
+  _controls = controls;
+  _controls.mouse_move = mouse_move;
+  _controls.jump = jump;
+}
+
+double Simulation::render_tick() const
+{
+  std::lock_guard<std::mutex> lock{_mutex};
+  std::chrono::duration<double> elapsed = clock::now() - _start;
+  std::chrono::duration<double> tick = tick_duration();
+  return elapsed.count() / tick.count() - 1;
+}
+
+void Simulation::run()
+{
+  uint64_t tick = 0;
+  while (_running) {
+    ControlData controls;
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      controls = _controls;
+      _controls.mouse_move = glm::vec2{};
+      _controls.jump = false;
+    }
+    _world.update(controls);
+    ++tick;
+
+    auto now = clock::now();
+    auto elapsed = clock::rep(tick) * tick_duration();
+    clock::time_point next;
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      if (now - _start > elapsed + MAX_LAG_TICKS * tick_duration()) {
+        _start = now - elapsed;
+      }
+      next = _start + elapsed;
+    }
+    std::this_thread::sleep_until(next);
+  }
+}
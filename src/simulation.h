@@ -0,0 +1,44 @@
+#ifndef MOBIUS_SIMULATION_H
+#define MOBIUS_SIMULATION_H
+
+#include "player.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+class World;
+// Runs the world's updates at a fixed rate on a thread of its own, so that
+// movement doesn't depend on the frame rate and slow updates don't hold up
+// rendering.
+class Simulation {
+public:
+  static const uint32_t TICKS_PER_SECOND = 60;
+  // If updates fall further behind than this, the simulation slows down
+  // instead of trying to catch up.
+  static const uint32_t MAX_LAG_TICKS = 8;
+
+  Simulation(World& world);
+  ~Simulation();
+
+  // Controls are merged until the next tick takes them: mouse movements add
+  // up, and a jump is kept until it's been seen.
+  void set_controls(const ControlData& controls);
+  // The tick to render at. It lags a tick behind the simulation, so that
+  // there's usually a snapshot either side of it to interpolate between.
+  double render_tick() const;
+
+private:
+  typedef std::chrono::steady_clock clock;
+  void run();
+
+  World& _world;
+  mutable std::mutex _mutex;
+  ControlData _controls;
+  // When tick 0 would have been, given the ticks since.
+  clock::time_point _start;
+  std::atomic<bool> _running;
+  std::thread _thread;
+};
+
+#endif
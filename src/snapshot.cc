@@ -0,0 +1,35 @@
+#include "snapshot.h"
+#include <glm/vec4.hpp>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <algorithm>
+
+void interpolate(const Snapshot& a, const Snapshot& b, float t,
+                 Snapshot& result)
+{
+  result = b;
+  // Between ticks either side of a portal there's nothing sensible to
+  // interpolate, since the eye might end up on the wrong side of it.
+  if (a.active_chunk != b.active_chunk || a.orientation != b.orientation) {
+    return;
+  }
+  result.player_position = glm::mix(a.player_position, b.player_position, t);
+  result.eye = glm::mix(a.eye, b.eye, t);
+  result.look_direction =
+      glm::normalize(glm::mix(a.look_direction, b.look_direction, t));
+
+  auto chunks = std::min(a.chunk_objects.size(), b.chunk_objects.size());
+  for (size_t chunk = 0; chunk + 1 < chunks; ++chunk) {
+    auto begin = a.objects.begin() + a.chunk_objects[chunk];
+    auto end = a.objects.begin() + a.chunk_objects[1 + chunk];
+    for (auto i = b.chunk_objects[chunk]; i < b.chunk_objects[1 + chunk]; ++i) {
+      auto& o = result.objects[i];
+      auto it = std::lower_bound(begin, end, o);
+      if (it != end && it->object == o.object &&
+          it->placement == o.placement) {
+        o.transform.translation =
+            glm::mix(it->transform.translation, o.transform.translation, t);
+      }
+    }
+  }
+}
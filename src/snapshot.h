@@ -0,0 +1,53 @@
+#ifndef MOBIUS_SNAPSHOT_H
+#define MOBIUS_SNAPSHOT_H
+
+#include "rigid_transform.h"
+#include <glm/vec3.hpp>
+#include <cstdint>
+#include <vector>
+
+class Mesh;
+// Everything rendering needs from one tick of the simulation. Snapshots are
+// never changed once published, so they can be read from another thread.
+struct Snapshot {
+  struct object {
+    uint32_t object;
+    // 0 for the object itself, otherwise one of its ghosts.
+    uint32_t placement;
+    const Mesh* mesh;
+    float radius;
+    // In the space of the chunk it's in.
+    RigidTransform transform;
+
+    bool operator<(const Snapshot::object& o) const
+    {
+      return object != o.object ? object < o.object : placement < o.placement;
+    }
+  };
+
+  uint64_t tick = 0;
+  uint32_t active_chunk = 0;
+  // Active chunk space to player space.
+  RigidTransform orientation;
+
+  uint32_t player_object = 0;
+  glm::vec3 player_position;
+  glm::vec3 eye;
+  glm::vec3 look_direction;
+  float fov = 0;
+  float z_near = 0;
+  float z_far = 0;
+
+  // Sorted by chunk, and then as above. The objects in chunk i are those from
+  // chunk_objects[i] up to chunk_objects[i + 1].
+  std::vector<object> objects;
+  std::vector<uint32_t> chunk_objects;
+};
+
+// Moves a fraction t of the way from a to b, except across a change of
+// chunk, where it just takes b. Only translations are interpolated. The
+// result is passed in so that it can keep its capacity between frames.
+void interpolate(const Snapshot& a, const Snapshot& b, float t,
+                 Snapshot& result);
+
+#endif
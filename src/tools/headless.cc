@@ -0,0 +1,90 @@
+// Runs the simulation without a window or GL context, as fast as it will go,
+// and reports how fast that was. Several instances can be run at once, each
+// with a world of its own on a thread of its own. Given a number of agents,
+// each instance steps that many (in parallel) rather than the player. The
+// instances share a set of job threads; with none, everything runs in order
+// on the instance's own thread, which makes runs repeatable.
+#include "../world.h"
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+  // Walks forward, weaving from side to side and jumping every so often, so
+  // that the player actually goes places (including through portals).
+  ControlData bot_controls(uint64_t tick)
+  {
+    ControlData controls;
+    controls.forward = true;
+    controls.jump = tick % 128 == 0;
+    controls.mouse_move = {tick % 256 < 128 ? 4 : -4, 0};
+    return controls;
+  }
+
+  // Returns the time taken to step the world, in seconds.
+  double run(const std::string& world_path, uint64_t ticks,
+             uint32_t agent_count, Jobs& jobs)
+  {
+    World world{world_path, jobs};
+    world.load_all();
+    Agents agents;
+    world.spawn(agents, agent_count);
+    std::vector<ControlData> controls{agent_count};
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t tick = 0; tick < ticks; ++tick) {
+      if (!agent_count) {
+        world.update(bot_controls(tick));
+        continue;
+      }
+      // Out of step with each other, so that they spread out.
+      for (uint32_t i = 0; i < agent_count; ++i) {
+        controls[i] = bot_controls(tick + 37 * i);
+      }
+      world.update(agents, controls);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+  }
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2 || argc > 6) {
+    std::cerr << "usage: " << argv[0] <<
+        " world [ticks] [instances] [agents] [job threads]\n";
+    return 1;
+  }
+  std::string world_path = argv[1];
+  uint64_t ticks = argc > 2 ? std::stoull(argv[2]) : 6000;
+  uint32_t instances = argc > 3 ? uint32_t(std::stoul(argv[3])) : 1;
+  uint32_t agents = argc > 4 ? uint32_t(std::stoul(argv[4])) : 0;
+  uint32_t job_threads = argc > 5 ? uint32_t(std::stoul(argv[5])) :
+      std::thread::hardware_concurrency();
+  Jobs jobs{job_threads};
+
+  std::vector<double> seconds(instances);
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < instances; ++i) {
+    threads.emplace_back([&, i]
+    {
+      seconds[i] = run(world_path, ticks, agents, jobs);
+    });
+  }
+  double ticks_per_second = 0;
+  for (uint32_t i = 0; i < instances; ++i) {
+    threads[i].join();
+    ticks_per_second += ticks / seconds[i];
+    std::cout << "instance " << i << ": " << ticks << " ticks in " <<
+        seconds[i] << "s\n";
+  }
+  std::cout << "total: " << uint64_t(ticks_per_second) << " ticks/s\n";
+  if (agents) {
+    std::cout << "total: " << uint64_t(agents * ticks_per_second) <<
+        " agent-ticks/s\n";
+  }
+  return 0;
+}
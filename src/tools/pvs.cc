@@ -0,0 +1,393 @@
+// Computes, for each portal in each chunk, which other portals in the chunk
+// might be visible when looking into the chunk through it. This errs on the
+// side of visible, since the renderer trusts it completely: a pair is only
+// hidden if every line between the two is blocked.
+#include "../proto_util.h"
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/geometric.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+  struct Triangle {
+    glm::vec3 a;
+    glm::vec3 b;
+    glm::vec3 c;
+  };
+
+  // Number of subdivisions along each triangle edge when splitting portals
+  // into cells. More cells means fewer pairs conservatively left visible.
+  static const uint32_t CELL_RESOLUTION = 4;
+  // Distances below this are treated as being on a plane.
+  static const float epsilon = 1. / 4096;
+  typedef std::vector<glm::vec2> Polygon;
+
+  std::vector<Triangle> mesh_triangles(const mobius::proto::mesh& mesh,
+                                       uint32_t flags)
+  {
+    std::vector<Triangle> result;
+    for (const auto& submesh : mesh.submesh()) {
+      if (!(submesh.flags() & flags)) {
+        continue;
+      }
+      auto transform = submesh_transform(submesh);
+      const auto& geometry = mesh.geometry(submesh.geometry());
+      for (size_t i = 0; i < geometry_size(geometry); ++i) {
+        auto t = geometry_tri(geometry, i);
+        glm::vec3 va{transform * glm::vec4{load_vec3(mesh.vertex(t.a)), 1}};
+        glm::vec3 vb{transform * glm::vec4{load_vec3(mesh.vertex(t.b)), 1}};
+        glm::vec3 vc{transform * glm::vec4{load_vec3(mesh.vertex(t.c)), 1}};
+        if (glm::cross(vb - va, vc - va) != glm::vec3{}) {
+          result.push_back({va, vb, vc});
+        }
+      }
+    }
+    return result;
+  }
+
+  // Splits each triangle into smaller ones, so that beams between pieces of
+  // two portals are narrow enough to be blocked by a single wall.
+  std::vector<Triangle> cells(const std::vector<Triangle>& triangles)
+  {
+    std::vector<Triangle> result;
+    for (const auto& t : triangles) {
+      auto point = [&](uint32_t i, uint32_t j)
+      {
+        float u = float(i) / CELL_RESOLUTION;
+        float v = float(j) / CELL_RESOLUTION;
+        return (1 - u - v) * t.a + u * t.b + v * t.c;
+      };
+      for (uint32_t i = 0; i < CELL_RESOLUTION; ++i) {
+        for (uint32_t j = 0; i + j < CELL_RESOLUTION; ++j) {
+          result.push_back({point(i, j), point(1 + i, j), point(i, 1 + j)});
+          if (i + j + 1 < CELL_RESOLUTION) {
+            result.push_back(
+                {point(1 + i, j), point(1 + i, 1 + j), point(i, 1 + j)});
+          }
+        }
+      }
+    }
+    return result;
+  }
+
+  // Same as Collision::ray_tri_intersection, restricted to the open segment
+  // from origin to origin + direction. Only front faces block the view, since
+  // back faces are culled. The triangle's edges count too, so that the seams
+  // between faces of a wall don't let anything through.
+  bool segment_blocked(const glm::vec3& origin, const glm::vec3& direction,
+                       const Triangle& t)
+  {
+    static const float epsilon = 1. / (1024 * 1024);
+
+    auto ab = t.b - t.a;
+    auto ac = t.c - t.a;
+    auto pv = glm::cross(direction, ac);
+    float determinant = glm::dot(pv, ab);
+    if (determinant < epsilon) {
+      return false;
+    }
+
+    auto tv = origin - t.a;
+    float u = glm::dot(tv, pv);
+    if (u < 0 || u > determinant) {
+      return false;
+    }
+
+    auto qv = glm::cross(tv, ab);
+    float v = glm::dot(direction, qv);
+    if (v < 0 || u + v > determinant) {
+      return false;
+    }
+
+    float bound = glm::dot(ac, qv) / determinant;
+    return bound > epsilon && bound < 1 - epsilon;
+  }
+
+  float cross2(const glm::vec2& a, const glm::vec2& b)
+  {
+    return a.x * b.y - a.y * b.x;
+  }
+
+  // Andrew's monotone chain. Result is counter-clockwise.
+  Polygon convex_hull(Polygon points)
+  {
+    std::sort(points.begin(), points.end(),
+              [](const glm::vec2& a, const glm::vec2& b)
+    {
+      return a.x != b.x ? a.x < b.x : a.y < b.y;
+    });
+    if (points.size() < 3) {
+      return points;
+    }
+    Polygon hull(2 * points.size());
+    size_t k = 0;
+    for (size_t i = 0; i < points.size(); ++i) {
+      while (k >= 2 &&
+             cross2(hull[k - 1] - hull[k - 2], points[i] - hull[k - 2]) <= 0) {
+        --k;
+      }
+      hull[k++] = points[i];
+    }
+    for (size_t i = points.size() - 1, t = k + 1; i > 0; --i) {
+      while (k >= t &&
+             cross2(hull[k - 1] - hull[k - 2], points[i - 1] - hull[k - 2]) <=
+                 0) {
+        --k;
+      }
+      hull[k++] = points[i - 1];
+    }
+    hull.resize(k - 1);
+    return hull;
+  }
+
+  float polygon_area(const Polygon& poly)
+  {
+    float area = 0;
+    for (size_t i = 0; i < poly.size(); ++i) {
+      area += cross2(poly[i], poly[(i + 1) % poly.size()]);
+    }
+    return area / 2;
+  }
+
+  // The part of the convex polygon where dot(normal, p) + offset >= 0.
+  Polygon clip_polygon(const Polygon& poly,
+                       const glm::vec2& normal, float offset)
+  {
+    Polygon result;
+    for (size_t i = 0; i < poly.size(); ++i) {
+      const auto& a = poly[i];
+      const auto& b = poly[(i + 1) % poly.size()];
+      auto da = glm::dot(normal, a) + offset;
+      auto db = glm::dot(normal, b) + offset;
+      if (da >= 0) {
+        result.push_back(a);
+      }
+      if ((da >= 0) != (db >= 0)) {
+        result.push_back(a + da / (da - db) * (b - a));
+      }
+    }
+    return result;
+  }
+
+  // Front faces of the chunk that lie in one plane, in coordinates on it.
+  struct OccluderPlane {
+    glm::vec3 normal;
+    float offset;
+    glm::vec3 u;
+    glm::vec3 v;
+    // Counter-clockwise.
+    std::vector<Polygon> triangles;
+  };
+
+  std::vector<OccluderPlane> occluder_planes(
+      const std::vector<Triangle>& triangles)
+  {
+    std::vector<OccluderPlane> result;
+    for (const auto& t : triangles) {
+      auto normal = glm::normalize(glm::cross(t.b - t.a, t.c - t.a));
+      auto offset = -glm::dot(normal, t.a);
+      OccluderPlane* plane = nullptr;
+      for (auto& p : result) {
+        if (glm::dot(p.normal, normal) > 1 - epsilon &&
+            std::abs(p.offset - offset) < epsilon) {
+          plane = &p;
+          break;
+        }
+      }
+      if (!plane) {
+        auto u = std::abs(normal.x) < .5f ? glm::vec3{1, 0, 0} :
+                                             glm::vec3{0, 1, 0};
+        u = glm::normalize(glm::cross(normal, u));
+        result.push_back({normal, offset, u, glm::cross(normal, u), {}});
+        plane = &result.back();
+      }
+      Polygon projected;
+      for (const auto& p : {t.a, t.b, t.c}) {
+        projected.push_back({glm::dot(p, plane->u), glm::dot(p, plane->v)});
+      }
+      plane->triangles.push_back(convex_hull(projected));
+    }
+    return result;
+  }
+
+  // Whether the plane's faces cover every segment from one cell to the other.
+  // The segments between two triangles on either side of the plane make a
+  // convex solid, whose cross-section is the hull of where the segments
+  // between their corners cross; it's blocked if nothing is left of that once
+  // the faces are cut out.
+  bool beam_blocked(const Triangle& from, const Triangle& to,
+                    const OccluderPlane& plane)
+  {
+    auto distance = [&](const glm::vec3& p)
+    {
+      return glm::dot(plane.normal, p) + plane.offset;
+    };
+    for (const auto& p : {from.a, from.b, from.c}) {
+      if (distance(p) <= epsilon) {
+        return false;
+      }
+    }
+    for (const auto& q : {to.a, to.b, to.c}) {
+      if (distance(q) >= -epsilon) {
+        return false;
+      }
+    }
+
+    Polygon crossings;
+    for (const auto& p : {from.a, from.b, from.c}) {
+      for (const auto& q : {to.a, to.b, to.c}) {
+        auto x = p + distance(p) / (distance(p) - distance(q)) * (q - p);
+        crossings.push_back({glm::dot(x, plane.u), glm::dot(x, plane.v)});
+      }
+    }
+    std::vector<Polygon> remaining{convex_hull(crossings)};
+    for (const auto& t : plane.triangles) {
+      std::vector<Polygon> outside;
+      for (auto piece : remaining) {
+        // Whatever's outside each edge in turn survives; what's inside all
+        // three is covered.
+        for (size_t i = 0; i < t.size() && !piece.empty(); ++i) {
+          const auto& a = t[i];
+          const auto& b = t[(i + 1) % t.size()];
+          glm::vec2 normal{a.y - b.y, b.x - a.x};
+          auto offset = -glm::dot(normal, a);
+          auto out = clip_polygon(piece, -normal, -offset);
+          if (polygon_area(out) > epsilon * epsilon) {
+            outside.push_back(out);
+          }
+          piece = clip_polygon(piece, normal, offset);
+        }
+      }
+      remaining.swap(outside);
+      if (remaining.empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  struct PortalCells {
+    glm::vec3 origin;
+    glm::vec3 normal;
+    std::vector<Triangle> cells;
+  };
+
+  bool behind(const Triangle& t, const glm::vec3& origin,
+              const glm::vec3& normal)
+  {
+    for (const auto& p : {t.a, t.b, t.c}) {
+      if (glm::dot(p - origin, normal) > 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Looking into the chunk through the entry portal, everything visible is on
+  // the inside of the entry portal, and the exit portal is only seen from its
+  // inside. Otherwise, the exit is only hidden if, for every pair of cells,
+  // some wall blocks every line between them; so a gap anywhere keeps it
+  // visible.
+  bool portal_visible(const PortalCells& entry, const PortalCells& exit,
+                      const std::vector<Triangle>& occluders,
+                      const std::vector<OccluderPlane>& planes)
+  {
+    for (const auto& p : entry.cells) {
+      if (behind(p, exit.origin, exit.normal)) {
+        continue;
+      }
+      for (const auto& q : exit.cells) {
+        if (behind(q, entry.origin, entry.normal)) {
+          continue;
+        }
+        // Quick check for the obvious case first. Since edges block, this
+        // can't be fooled by a line down a seam.
+        auto from = (p.a + p.b + p.c) / 3.f;
+        auto to = (q.a + q.b + q.c) / 3.f;
+        bool blocked = false;
+        for (const auto& t : occluders) {
+          if (segment_blocked(from, to - from, t)) {
+            blocked = true;
+            break;
+          }
+        }
+        if (!blocked) {
+          return true;
+        }
+
+        blocked = false;
+        for (const auto& plane : planes) {
+          if (beam_blocked(p, q, plane)) {
+            blocked = true;
+            break;
+          }
+        }
+        if (!blocked) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  void compute_pvs(mobius::proto::chunk& chunk)
+  {
+    auto occluders = mesh_triangles(
+        chunk.mesh(), mobius::proto::submesh::VISIBLE);
+    auto planes = occluder_planes(occluders);
+
+    std::vector<PortalCells> portals;
+    for (const auto& portal : chunk.portal()) {
+      auto triangles = mesh_triangles(
+          portal.portal_mesh(),
+          mobius::proto::submesh::VISIBLE | mobius::proto::submesh::PHYSICAL);
+      portals.push_back({load_vec3(portal.local().origin()),
+                         load_vec3(portal.local().normal()),
+                         cells(triangles)});
+    }
+
+    uint32_t total = 0;
+    for (int i = 0; i < chunk.portal_size(); ++i) {
+      auto& entry = *chunk.mutable_portal(i);
+      entry.clear_visible_portal();
+      for (int j = 0; j < chunk.portal_size(); ++j) {
+        if (i != j &&
+            portal_visible(portals[i], portals[j], occluders, planes)) {
+          entry.add_visible_portal(j);
+        }
+      }
+      total += entry.visible_portal_size();
+    }
+    chunk.set_portal_pvs(true);
+
+    auto pairs = chunk.portal_size() * (chunk.portal_size() - 1);
+    std::cout << "chunk '" << chunk.name() << "': " << total << " of " <<
+        pairs << " portal pairs potentially visible\n";
+  }
+}
+
+int main(int argc, char** argv)
+{
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " input output\n";
+    return 1;
+  }
+
+  auto world = load_proto<mobius::proto::world>(argv[1]);
+  for (auto& chunk : *world.mutable_chunk()) {
+    compute_pvs(chunk);
+  }
+
+  std::ofstream output(argv[2], std::ios::binary);
+  if (!world.SerializeToOstream(&output)) {
+    std::cerr << "couldn't write " << argv[2] << "\n";
+    return 1;
+  }
+  return 0;
+}
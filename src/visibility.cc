@@ -1,91 +1,178 @@
 #include "visibility.h"
-#include "geometry.h"
-#include "player.h"
+#include "camera.h"
 #include "world.h"
+#include <glm/common.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/vec2.hpp>
 #include <glm/vec4.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 
 namespace {
-  std::vector<Plane>
-  calculate_bounding_planes(const glm::vec3& eye,
-                            const glm::vec3& bl, const glm::vec3& tl,
-                            const glm::vec3& br, const glm::vec3& tr)
+  // One of the hardware clip distances is reserved for the plane behind the
+  // portal.
+  static const uint32_t MAX_BOUNDING_PLANES = MAX_CLIP_PLANES - 1;
+  typedef arena_vector<glm::vec2> polygon;
+
+  float cross2(const glm::vec2& a, const glm::vec2& b)
   {
-    auto bn = glm::normalize(glm::cross(br - eye, bl - eye));
-    auto tn = glm::normalize(glm::cross(tl - eye, tr - eye));
-    auto ln = glm::normalize(glm::cross(bl - eye, tl - eye));
-    auto rn = glm::normalize(glm::cross(tr - eye, br - eye));
-
-    std::vector<Plane> result;
-    result.emplace_back(bl, bn);
-    result.emplace_back(tr, tn);
-    result.emplace_back(tl, ln);
-    result.emplace_back(br, rn);
+    return a.x * b.y - a.y * b.x;
+  }
+
+  // Andrew's monotone chain. Result is counter-clockwise with no collinear
+  // points.
+  polygon convex_hull(polygon points)
+  {
+    if (points.size() < 3) {
+      return points;
+    }
+    std::sort(points.begin(), points.end(),
+              [](const glm::vec2& a, const glm::vec2& b)
+              {
+                return a.x < b.x || (a.x == b.x && a.y < b.y);
+              });
+
+    polygon hull(2 * points.size(), glm::vec2{}, points.get_allocator());
+    size_t k = 0;
+    auto add_point = [&](const glm::vec2& p, size_t lower_bound)
+    {
+      while (k >= lower_bound &&
+             cross2(hull[k - 1] - hull[k - 2], p - hull[k - 2]) <= 0) {
+        --k;
+      }
+      hull[k++] = p;
+    };
+
+    for (size_t i = 0; i < points.size(); ++i) {
+      add_point(points[i], 2);
+    }
+    for (size_t i = points.size() - 1, lower = k + 1; i > 0; --i) {
+      add_point(points[i - 1], lower);
+    }
+    hull.resize(k - 1);
+    return hull;
+  }
+
+  // Sutherland-Hodgman against the half-plane dot(normal, v) <= offset.
+  polygon clip_polygon(const polygon& poly,
+                       const glm::vec2& normal, float offset)
+  {
+    polygon result{poly.get_allocator()};
+    for (size_t i = 0; i < poly.size(); ++i) {
+      const auto& a = poly[i];
+      const auto& b = poly[(i + 1) % poly.size()];
+      auto da = offset - glm::dot(normal, a);
+      auto db = offset - glm::dot(normal, b);
+
+      if (da >= 0) {
+        result.push_back(a);
+      }
+      // Strict, so that vertices on the line aren't duplicated.
+      if ((da > 0 && db < 0) || (da < 0 && db > 0)) {
+        result.push_back(a + da / (da - db) * (b - a));
+      }
+    }
     return result;
   }
-}
 
-std::vector<Plane>
-calculate_view_frustum(const Player& player, float aspect_ratio)
-{
-  const auto& eye = player.get_head_position();
-  const auto& dir = player.get_look_direction();
-  auto f = std::tan(player.get_fov() / 2);
+  // Reduces a convex counter-clockwise polygon to at most max_edges edges,
+  // such that the result still contains the original. Each step removes
+  // whichever edge adds the least area when its neighbours are extended to
+  // meet. For more than four edges there is always some edge whose
+  // neighbours meet on the outside.
+  void reduce_polygon(polygon& poly, size_t max_edges)
+  {
+    while (poly.size() > max_edges) {
+      auto n = poly.size();
+      bool found = false;
+      size_t best_index = 0;
+      float best_area = 0;
+      glm::vec2 best_point;
 
-  auto h = f * aspect_ratio * side_direction(dir);
-  auto v = f * up_direction(dir);
+      for (size_t i = 0; i < n; ++i) {
+        const auto& a = poly[(i + n - 1) % n];
+        const auto& b = poly[i];
+        const auto& c = poly[(i + 1) % n];
+        const auto& d = poly[(i + 2) % n];
 
-  auto bl = eye + dir - v - h;
-  auto tl = eye + dir + v - h;
-  auto br = eye + dir - v + h;
-  auto tr = eye + dir + v + h;
+        auto ab = b - a;
+        auto cd = d - c;
+        auto denominator = cross2(ab, cd);
+        if (denominator <= 0) {
+          continue;
+        }
+        auto t = cross2(c - b, cd) / denominator;
+        auto point = b + t * ab;
+        auto area = std::abs(cross2(point - b, c - b)) / 2;
+        if (!found || area < best_area) {
+          found = true;
+          best_index = i;
+          best_area = area;
+          best_point = point;
+        }
+      }
 
-  auto result = calculate_bounding_planes(eye, bl, tl, br, tr);
-  result.emplace_back(eye + player.get_z_near() * dir, dir);
-  result.emplace_back(eye + player.get_z_far() * dir, -dir);
-  return result;
-}
+      if (!found) {
+        return;
+      }
+      poly[best_index] = best_point;
+      poly.erase(poly.begin() + (best_index + 1) % n);
+    }
+  }
 
-std::vector<Plane>
-calculate_bounding_frustum(const Player& player, float aspect_ratio,
-                           const glm::mat4& transform, const Portal& portal)
-{
-  const auto& eye = player.get_head_position();
-  const auto& dir = player.get_look_direction();
-  auto max_y = std::tan(player.get_fov() / 2);
-  auto max_x = aspect_ratio * max_y;
+  float polygon_area(const polygon& poly)
+  {
+    float area = 0;
+    for (size_t i = 0; i < poly.size(); ++i) {
+      area += cross2(poly[i], poly[(i + 1) % poly.size()]);
+    }
+    return area / 2;
+  }
+
+  polygon view_polygon(const glm::vec2& min, const glm::vec2& max,
+                       Arena& arena)
+  {
+    polygon result{arena};
+    result.push_back(min);
+    result.push_back({max.x, min.y});
+    result.push_back(max);
+    result.push_back({min.x, max.y});
+    return result;
+  }
 
-  auto side = side_direction(dir);
-  auto up = up_direction(dir);
-  auto z_near = player.get_z_near();
+  // Planes through the eye and each edge of a convex counter-clockwise loop
+  // of points on the view plane.
+  void calculate_bounding_planes(PlaneSet& result, const glm::vec3& eye,
+                                 const arena_vector<glm::vec3>& points)
+  {
+    for (size_t i = 0; i < points.size(); ++i) {
+      const auto& a = points[i];
+      const auto& b = points[(i + 1) % points.size()];
+      result.add(a, glm::normalize(glm::cross(b - eye, a - eye)));
+    }
+  }
+}
 
-  bool first = true;
-  glm::vec2 min;
-  glm::vec2 max;
+PlaneSet calculate_bounding_frustum(
+    const Camera& camera, const RigidTransform& transform,
+    const Portal& portal, Arena& arena)
+{
+  const auto& eye = camera.eye;
+  const auto& dir = camera.dir;
+  auto z_near = camera.z_near;
 
+  polygon points{arena};
   auto handle_vertex = [&](const glm::vec3& v)
   {
-    // Just take the 2D bounding box in plane coordinates. This is not
-    // precise; a better way would be to reduce to a convex hull and from
-    // there to limited number of bounding planes, or to somehow consider many
-    // possible coordinate systems on the 2D plane and pick the best fit.
-    auto coords = view_plane_coords(eye, dir, v);
-    if (first) {
-      min = coords;
-      max = coords;
-    } else {
-      min = glm::min(min, coords);
-      max = glm::max(max, coords);
-    }
-    first = false;
+    points.push_back(camera.view_plane_coords(v));
   };
 
   for (const auto& t : portal.portal_mesh->physical_faces()) {
     // Clip the triangle against the player plane to avoid complications.
-    glm::vec3 ta{transform * glm::vec4{t.a, 1}};
-    glm::vec3 tb{transform * glm::vec4{t.b, 1}};
-    glm::vec3 tc{transform * glm::vec4{t.c, 1}};
+    auto ta = transform.point(t.a);
+    auto tb = transform.point(t.b);
+    auto tc = transform.point(t.c);
 
     auto da = glm::dot(ta - eye - dir * z_near, dir);
     auto db = glm::dot(tb - eye - dir * z_near, dir);
@@ -127,62 +214,167 @@ calculate_bounding_frustum(const Player& player, float aspect_ratio,
     }
   }
 
-  min = glm::max(min, glm::vec2{-max_x, -max_y});
-  max = glm::min(max, glm::vec2{max_x, max_y});
+  // Take the convex hull of the projected portal, restrict it to the screen
+  // and then loosen it until it fits in the available clip planes.
+  auto hull = convex_hull(points);
+  hull = clip_polygon(hull, {1, 0}, camera.view_max.x);
+  hull = clip_polygon(hull, {-1, 0}, -camera.view_min.x);
+  hull = clip_polygon(hull, {0, 1}, camera.view_max.y);
+  hull = clip_polygon(hull, {0, -1}, -camera.view_min.y);
+  reduce_polygon(hull, MAX_BOUNDING_PLANES);
 
-  auto bl = eye + dir + min.x * side + min.y * up;
-  auto br = eye + dir + max.x * side + min.y * up;
-  auto tl = eye + dir + min.x * side + max.y * up;
-  auto tr = eye + dir + max.x * side + max.y * up;
-
-  auto result = calculate_bounding_planes(eye, bl, tl, br, tr);
+  PlaneSet result;
+  if (hull.size() < 3) {
+    // Nothing (or only a sliver) of the portal is on-screen, so clip
+    // everything.
+    result.add(eye, -dir);
+  } else {
+    arena_vector<glm::vec3> hull_points{arena};
+    for (const auto& p : hull) {
+      hull_points.push_back(camera.view_plane_point(p));
+    }
+    calculate_bounding_planes(result, eye, hull_points);
+  }
   // We also have to clip behind the portal so that we don't see overlapping
   // geometry hanging about.
-  auto normal_transform = glm::transpose(glm::inverse(glm::mat3{transform}));
-  glm::vec3 clip_point{transform * glm::vec4{portal.local.origin, 1}};
-  auto clip_normal = -normal_transform * portal.local.normal;
-  result.emplace_back(clip_point, clip_normal);
+  result.add(transform.point(portal.local.origin),
+             -transform.vector(portal.local.normal));
   return result;
 }
 
-bool mesh_visible(const std::vector<Plane>& planes, const glm::vec3& eye,
-                  const glm::mat4& transform, const Mesh& mesh)
+PlaneSet compose_frustum(const Camera& camera,
+                         const PlaneSet& parent, const PlaneSet& child,
+                         Arena& arena, ViewFootprint* footprint)
 {
-  auto check = [&](const glm::vec3& point, const glm::vec3& normal,
-                   const glm::vec3& v)
+  static const float epsilon = 1. / 4096;
+  const auto& eye = camera.eye;
+  const auto& dir = camera.dir;
+  const auto& side = camera.side;
+  const auto& up = camera.up;
+
+  // Planes through the eye are intersected as half-planes on the view plane,
+  // which automatically discards the ones that don't contribute an edge.
+  // Everything else (the planes behind each portal) is kept for now, newest
+  // first.
+  auto cone = view_polygon(camera.view_min, camera.view_max, arena);
+  arena_vector<glm::vec4> others{arena};
+  auto handle_planes = [&](const PlaneSet& planes)
   {
-    return glm::dot(v - point, normal) >= 0;
+    for (uint32_t i = 0; i < planes.size(); ++i) {
+      auto normal = planes.normal(i);
+      if (std::abs(planes.distance(i, eye)) > epsilon * glm::length(normal)) {
+        others.push_back(planes.plane(i));
+        continue;
+      }
+      cone = clip_polygon(
+          cone, {-glm::dot(normal, side), -glm::dot(normal, up)},
+          glm::dot(normal, dir));
+    }
   };
+  handle_planes(child);
+  handle_planes(parent);
 
-  auto inside_all = [&](const glm::vec3& v)
+  PlaneSet result;
+  if (footprint) {
+    *footprint = {polygon_area(cone), {}, {}};
+    if (!cone.empty()) {
+      footprint->min = footprint->max = cone[0];
+    }
+    for (const auto& p : cone) {
+      footprint->min = glm::min(footprint->min, p);
+      footprint->max = glm::max(footprint->max, p);
+    }
+  }
+  if (cone.size() < 3) {
+    result.add(eye, -dir);
+    return result;
+  }
+  // Growing the cone to fewer edges first means the planes behind it get
+  // whatever's left. A convex polygon can always be cut down this far, since
+  // only a rectangle or less has no two edges that can be extended to meet.
+  reduce_polygon(cone, MAX_BOUNDING_PLANES);
+
+  // Directions of the edges of the cone.
+  arena_vector<glm::vec3> rays{arena};
+  for (const auto& p : cone) {
+    rays.push_back(dir + p.x * side + p.y * up);
+  }
+
+  // A plane can't clip anything inside the cone if the eye and every ray are
+  // on its positive side. Otherwise, it's still redundant given some plane
+  // we've already kept if that one cuts every ray, and everything beyond the
+  // cuts is on its positive side.
+  arena_vector<glm::vec4> kept{arena};
+  auto contains = [&](const glm::vec4& plane, const glm::vec3& v)
+  {
+    return glm::dot(glm::vec3{plane}, v) + plane.w >= -epsilon;
+  };
+  auto contains_rays = [&](const glm::vec4& plane)
   {
-    for (const auto& plane : planes) {
-      if (!check(plane.first, plane.second, v)) {
+    for (const auto& ray : rays) {
+      if (glm::dot(glm::vec3{plane}, ray) < 0) {
         return false;
       }
     }
     return true;
   };
-
-  auto outside_any = [&](
-      const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+  auto redundant_given = [&](const glm::vec4& plane, const glm::vec4& other)
   {
-    for (const auto& plane : planes) {
-      if (!check(plane.first, plane.second, a) &&
-          !check(plane.first, plane.second, b) &&
-          !check(plane.first, plane.second, c)) {
-        return true;
+    glm::vec3 other_normal{other};
+    for (const auto& ray : rays) {
+      auto speed = glm::dot(other_normal, ray);
+      if (speed <= 0) {
+        return false;
+      }
+      auto t = -(glm::dot(other_normal, eye) + other.w) / speed;
+      if (!contains(plane, eye + std::max(0.f, t) * ray)) {
+        return false;
       }
     }
-    return false;
+    return true;
   };
 
+  for (const auto& plane : others) {
+    if (kept.size() + cone.size() >= MAX_CLIP_PLANES) {
+      break;
+    }
+    if (contains(plane, eye) && contains_rays(plane)) {
+      continue;
+    }
+    bool redundant = false;
+    for (const auto& other : kept) {
+      if (contains_rays(plane) && redundant_given(plane, other)) {
+        redundant = true;
+        break;
+      }
+    }
+    if (!redundant) {
+      kept.push_back(plane);
+    }
+  }
+
+  arena_vector<glm::vec3> cone_points{arena};
+  for (const auto& p : cone) {
+    cone_points.push_back(camera.view_plane_point(p));
+  }
+  calculate_bounding_planes(result, eye, cone_points);
+  for (const auto& plane : kept) {
+    result.add(plane);
+  }
+  // The renderer silently drops anything past the limit.
+  assert(result.size() <= MAX_CLIP_PLANES);
+  return result;
+}
+
+bool mesh_visible(const PlaneSet& planes, const glm::vec3& eye,
+                  const RigidTransform& transform, const Mesh& mesh)
+{
   // Simple visibility determination. We will probably need something more
   // robust.
   for (const auto& t : mesh.physical_faces()) {
-    glm::vec3 a{transform * glm::vec4{t.a, 1}};
-    glm::vec3 b{transform * glm::vec4{t.b, 1}};
-    glm::vec3 c{transform * glm::vec4{t.c, 1}};
+    auto a = transform.point(t.a);
+    auto b = transform.point(t.b);
+    auto c = transform.point(t.c);
 
     // Back face cull.
     auto normal = glm::cross(b - a, c - a);
@@ -190,9 +382,9 @@ bool mesh_visible(const std::vector<Plane>& planes, const glm::vec3& eye,
       continue;
     }
 
-    // (Conservative) view frustum intersection.
-    if (inside_all(a) || inside_all(b) || inside_all(c) ||
-        !outside_any(a, b, c)) {
+    // (Conservative) view frustum intersection: visible unless all three
+    // vertices are outside the same plane.
+    if (!planes.excludes(a, b, c)) {
       return true;
     }
   }
@@ -1,25 +1,37 @@
 #ifndef MOBIUS_VISIBILITY_H
 #define MOBIUS_VISIBILITY_H
 
-#include <glm/mat4x4.hpp>
+#include "arena.h"
+#include "plane_set.h"
+#include "rigid_transform.h"
+#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
-#include <utility>
-#include <vector>
 
-class Player;
+struct Camera;
 class Mesh;
 struct Portal;
-typedef std::pair<glm::vec3, glm::vec3> Plane;
 
-std::vector<Plane>
-calculate_view_frustum(const Player& player, float aspect_ratio);
+// Extent of a frustum on the view plane (at distance 1 from the eye).
+struct ViewFootprint {
+  float area;
+  glm::vec2 min;
+  glm::vec2 max;
+};
 
-std::vector<Plane>
-calculate_bounding_frustum(const Player& player, float aspect_ratio,
-                           const glm::mat4& transform, const Portal& portal);
+// Scratch space comes from the arena.
+PlaneSet calculate_bounding_frustum(
+    const Camera& camera, const RigidTransform& transform,
+    const Portal& portal,
+    Arena& arena);
 
-bool mesh_visible(const std::vector<Plane>& planes,
-                  const glm::vec3& eye,
-                  const glm::mat4& transform, const Mesh& mesh);
+// Intersection of two frusta (as produced by calculate_bounding_frustum)
+// with redundant planes dropped and the rest loosened to fit the hardware
+// clip distances. Optionally returns the footprint of the result.
+PlaneSet compose_frustum(const Camera& camera,
+                         const PlaneSet& parent, const PlaneSet& child,
+                         Arena& arena, ViewFootprint* footprint = nullptr);
+
+bool mesh_visible(const PlaneSet& planes, const glm::vec3& eye,
+                  const RigidTransform& transform, const Mesh& mesh);
 
 #endif
@@ -1,12 +1,16 @@
 #include "world.h"
+#include "camera.h"
+#include "frame_packet.h"
 #include "mesh.h"
 #include "proto_util.h"
-#include "render.h"
 #include "visibility.h"
 #include <glm/vec4.hpp>
 #include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <unordered_map>
 
 namespace {
   glm::mat4 orientation_matrix(const Orientation& orientation, bool direction)
@@ -17,11 +21,25 @@ namespace {
     return glm::lookAt(orientation.origin, target, orientation.up);
   }
 
-  glm::mat4 portal_matrix(const Portal& portal)
+  RigidTransform portal_transform(const Portal& portal)
   {
     auto local = orientation_matrix(portal.local, false);
     auto remote = orientation_matrix(portal.remote, true);
-    return glm::inverse(local) * remote;
+    return RigidTransform::from_matrix(glm::inverse(local) * remote);
+  }
+
+  Bounds portal_bounds(const Portal& portal)
+  {
+    const auto& vertices = portal.portal_mesh->physical_vertices();
+    if (vertices.empty()) {
+      return {portal.local.origin, portal.local.origin};
+    }
+    Bounds bounds{vertices[0], vertices[0]};
+    for (const auto& v : vertices) {
+      bounds.min = glm::min(bounds.min, v);
+      bounds.max = glm::max(bounds.max, v);
+    }
+    return bounds;
   }
 
   static const uint32_t VALUE_BITS = 0x7f;
@@ -32,18 +50,30 @@ namespace {
   }
 }
 
-World::World(const std::string& path, Renderer& renderer)
-: _renderer(renderer)
+World::World(const std::string& path, Jobs& jobs,
+             const Residency::config& residency)
+: _jobs(jobs)
 , _player{_collision, {0, 1, 0}, glm::pi<float>() / 2, 1. / 256, 256}
+, _agent_scratch{jobs}
+, _source{new mobius::proto::world{load_proto<mobius::proto::world>(path)}}
+, _residency{residency}
+, _loads{jobs}
 {
-  auto world = load_proto<mobius::proto::world>(path);
-  for (const auto& chunk_proto : world.chunk()) {
-    if (_active_chunk.empty()) {
-      _active_chunk = chunk_proto.name();
+  const auto& world = *_source;
+  std::unordered_map<std::string, uint32_t> chunk_indices;
+  for (int i = 0; i < world.chunk_size(); ++i) {
+    const auto& chunk_proto = world.chunk(i);
+    if (chunk_indices.count(chunk_proto.name())) {
+      continue;
     }
+    chunk_indices.emplace(chunk_proto.name(), uint32_t(_chunks.size()));
+    _chunks.emplace_back();
+    _chunk_sources.push_back(i);
 
-    Chunk& chunk = _chunks[chunk_proto.name()];
-    chunk.mesh.reset(new Mesh{chunk_proto.mesh()});
+    // The mesh is loaded when it's needed.
+    Chunk& chunk = *_chunks.rbegin();
+    chunk.name = chunk_proto.name();
+    chunk.has_portal_pvs = chunk_proto.portal_pvs();
     for (const auto& portal_proto : chunk_proto.portal()) {
       chunk.portals.emplace_back();
       auto& portal = *chunk.portals.rbegin();
@@ -58,48 +88,309 @@ World::World(const std::string& path, Renderer& renderer)
       portal.remote.origin = load_vec3(portal_proto.remote().origin());
       portal.remote.normal = load_vec3(portal_proto.remote().normal());
       portal.remote.up = load_vec3(portal_proto.remote().up());
+
+      portal.bounds = portal_bounds(portal);
+      portal.transform = portal_transform(portal);
+      portal.inverse_transform = portal.transform.inverse();
+
+      for (auto index : portal_proto.visible_portal()) {
+        if (index < uint32_t(chunk_proto.portal_size())) {
+          portal.visible_portals.push_back(index);
+        }
+      }
+      std::sort(portal.visible_portals.begin(), portal.visible_portals.end());
     }
+
+    std::vector<Bounds> bounds;
+    for (const auto& portal : chunk.portals) {
+      bounds.push_back(portal.bounds);
+    }
+    chunk.portal_index = Bvh{bounds};
+  }
+
+  // Resolve portal targets once everything is loaded, so that nothing needs
+  // to look chunks up by name afterwards.
+  std::vector<std::vector<uint32_t>> neighbours{_chunks.size()};
+  for (uint32_t i = 0; i < _chunks.size(); ++i) {
+    for (auto& portal : _chunks[i].portals) {
+      auto it = chunk_indices.find(portal.chunk_name);
+      if (it != chunk_indices.end()) {
+        portal.chunk = it->second;
+        neighbours[i].push_back(portal.chunk);
+      }
+    }
+  }
+  _residency.reset(neighbours);
+
+  // The player is an object like any other, bounded by its whole mesh.
+  float radius = 0;
+  for (const auto& v : _player.get_mesh().physical_vertices()) {
+    radius = std::max(radius, glm::length(v));
   }
+  _player_object = _objects.add(&_player.get_mesh(), radius);
+  if (!_chunks.empty()) {
+    place_object(_player_object, _active_chunk,
+                 RigidTransform{_player.get_position()});
+  }
+  publish();
+  if (!_chunks.empty()) {
+    start_loads(*_current_snapshot);
+  }
+}
+
+World::~World()
+{
+  _stopping = true;
 }
 
 void World::update(const ControlData& controls)
 {
-  auto it = _chunks.find(_active_chunk);
-  if (it == _chunks.end()) {
+  if (_chunks.empty()) {
     return;
   }
+  // Nothing moves until there's something to stand on, but ticks still go
+  // by, so that snapshots keep pace with render.
+  if (std::atomic_load(&_chunks[_active_chunk].mesh)) {
+    move_player(controls);
+  }
+  ++_tick;
+  publish();
+}
+
+void World::move_player(const ControlData& controls)
+{
+  const auto& chunk = _chunks[_active_chunk];
+  _update_arena.reset();
+
+  // Chunk meshes can be unloaded by render at any time, so the ones in use
+  // are held on to until the next update. Any that aren't loaded just aren't
+  // collided with.
+  auto& environment = _environment;
+  environment.clear();
+  _environment_meshes.clear();
+  _environment_meshes.emplace_back(
+      _active_chunk, std::atomic_load(&_chunks[_active_chunk].mesh));
+  for (const auto& portal : chunk.portals) {
+    if (portal.chunk != Portal::NO_CHUNK) {
+      _environment_meshes.emplace_back(
+          portal.chunk, std::atomic_load(&_chunks[portal.chunk].mesh));
+    }
+  }
+  add_environment(_active_chunk, _orientation, [&](uint32_t index)
+  {
+    for (const auto& pair : _environment_meshes) {
+      if (pair.first == index) {
+        return pair.second.get();
+      }
+    }
+    return static_cast<const Mesh*>(nullptr);
+  }, environment);
+
+  // Other objects near the player get in the way too.
+  auto player_origin = _player.get_position();
+  auto local_origin = _orientation.inverse().point(player_origin);
+  glm::vec3 reach{_objects.radius(_player_object) + ObjectRegistry::CELL_SIZE};
+  arena_vector<uint32_t> nearby{_update_arena};
+  _objects.query(_active_chunk,
+                 {local_origin - reach, local_origin + reach}, nearby);
+  for (auto index : nearby) {
+    const auto& instance = _objects.get(index);
+    if (instance.object != _player_object) {
+      environment.push_back({_objects.mesh(instance.object),
+                             _orientation * instance.transform});
+    }
+  }
+
+  _player.update(controls, environment);
+  cross_portals(player_origin, _player.get_position() - player_origin,
+                _active_chunk, _orientation, _update_arena);
 
-  std::vector<Object> environment;
-  environment.push_back({it->second.mesh.get(), _orientation});
-  for (const auto& portal : it->second.portals) {
-    auto jt = _chunks.find(portal.chunk_name);
-    if (jt == _chunks.end()) {
+  place_object(_player_object, _active_chunk,
+               _orientation.inverse() * RigidTransform{_player.get_position()});
+}
+
+void World::update(Agents& agents, const std::vector<ControlData>& controls)
+{
+  // Meshes are only loaded once for the whole batch, since atomic loads of
+  // the same pointer from every thread at once would contend.
+  _agent_meshes.resize(_chunks.size());
+  for (uint32_t i = 0; i < _chunks.size(); ++i) {
+    _agent_meshes[i] = std::atomic_load(&_chunks[i].mesh);
+  }
+  std::function<const Mesh*(uint32_t)> mesh = [&](uint32_t index)
+  {
+    return _agent_meshes[index].get();
+  };
+
+  _jobs.parallel_for(0, agents.size(), AGENT_SLICE,
+                     [&](uint32_t begin, uint32_t end, uint32_t slot)
+  {
+    auto& scratch = _agent_scratch[slot];
+    for (auto i = begin; i < end; ++i) {
+      auto& chunk = agents.active_chunks[i];
+      auto& orientation = agents.orientations[i];
+      auto& position = agents.positions[i];
+      if (!_agent_meshes[chunk]) {
+        continue;
+      }
+      scratch.arena.reset();
+      scratch.environment.clear();
+      add_environment(chunk, orientation, mesh, scratch.environment);
+
+      auto origin = position;
+      Player::move(_collision, _player.get_mesh(), controls[i],
+                   scratch.environment, position, agents.angles[i],
+                   agents.fall_speeds[i]);
+      cross_portals(origin, position - origin, chunk, orientation,
+                    scratch.arena);
+    }
+  });
+}
+
+void World::spawn(Agents& agents, uint32_t count) const
+{
+  for (uint32_t i = 0; i < count; ++i) {
+    agents.add(0, RigidTransform{}, {0, 1, 0});
+  }
+}
+
+void World::place_object(uint32_t object, uint32_t chunk_index,
+                         const RigidTransform& transform)
+{
+  const auto& chunk = _chunks[chunk_index];
+  const auto& origin = transform.translation;
+  auto radius = _objects.radius(object);
+
+  ObjectRegistry::placement placements[ObjectRegistry::MAX_INSTANCES];
+  placements[0] = {chunk_index, transform};
+  uint32_t count = 1;
+
+  // Anything on the far side of a portal appears in the target chunk, placed
+  // by the inverse of the transform used to look through it.
+  arena_vector<uint32_t> candidates{_update_arena};
+  chunk.portal_index.query(origin, glm::vec3{}, glm::vec3{radius}, candidates);
+  std::sort(candidates.begin(), candidates.end());
+  for (auto index : candidates) {
+    const auto& portal = chunk.portals[index];
+    if (count == ObjectRegistry::MAX_INSTANCES) {
+      break;
+    }
+    if (portal.chunk == Portal::NO_CHUNK || radius < std::abs(
+            glm::dot(origin - portal.local.origin, portal.local.normal))) {
       continue;
     }
+    placements[count++] = {portal.chunk, portal.inverse_transform * transform};
+  }
+  _objects.place(object, placements, count);
+}
+
+void World::publish()
+{
+  // The render thread only ever drops its references, so once the pool has
+  // the only one, nothing else can be looking at the snapshot.
+  std::shared_ptr<Snapshot> snapshot;
+  for (const auto& s : _snapshot_pool) {
+    if (s.use_count() == 1) {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      snapshot = s;
+      break;
+    }
+  }
+  if (!snapshot) {
+    snapshot = std::make_shared<Snapshot>();
+    _snapshot_pool.push_back(snapshot);
+  }
+
+  auto& s = *snapshot;
+  s.tick = _tick;
+  s.active_chunk = _active_chunk;
+  s.orientation = _orientation;
+  s.player_object = _player_object;
+  s.player_position = _player.get_position();
+  s.eye = _player.get_head_position();
+  s.look_direction = _player.get_look_direction();
+  s.fov = _player.get_fov();
+  s.z_near = _player.get_z_near();
+  s.z_far = _player.get_z_far();
+
+  s.objects.clear();
+  s.chunk_objects.clear();
+  arena_vector<uint32_t> instances{_update_arena};
+  for (uint32_t i = 0; i < _chunks.size(); ++i) {
+    auto first = s.objects.size();
+    s.chunk_objects.push_back(uint32_t(first));
+    instances.clear();
+    _objects.query(i, instances);
+    for (auto index : instances) {
+      const auto& instance = _objects.get(index);
+      s.objects.push_back({
+          instance.object, instance.placement,
+          _objects.mesh(instance.object), _objects.radius(instance.object),
+          instance.transform});
+    }
+    std::sort(s.objects.begin() + first, s.objects.end());
+  }
+  s.chunk_objects.push_back(uint32_t(s.objects.size()));
+
+  std::lock_guard<std::mutex> lock{_snapshot_mutex};
+  _previous_snapshot = std::move(_current_snapshot);
+  _current_snapshot = snapshot;
+}
+
+void World::add_environment(
+    uint32_t chunk, const RigidTransform& orientation,
+    const std::function<const Mesh*(uint32_t chunk)>& mesh,
+    std::vector<Object>& environment) const
+{
+  if (auto chunk_mesh = mesh(chunk)) {
+    environment.push_back({chunk_mesh, orientation});
+  }
+  for (const auto& portal : _chunks[chunk].portals) {
     // The order looks wrong, but: we want to premultiply by
     //   orientation * portal_matrix * orientation^(-1)
     // which is the same as postmultiplying by portal_matrix.
-    environment.push_back(
-        {jt->second.mesh.get(), _orientation * portal_matrix(portal)});
+    if (portal.chunk == Portal::NO_CHUNK) {
+      continue;
+    }
+    if (auto portal_mesh = mesh(portal.chunk)) {
+      environment.push_back({portal_mesh, orientation * portal.transform});
+    }
   }
+}
 
-  auto player_origin = _player.get_position();
-  _player.update(controls, environment);
-  auto player_move = _player.get_position() - player_origin;
-  for (const auto& portal : it->second.portals) {
-    Object object{portal.portal_mesh.get(), _orientation};
-    // For the same reasons as general collision, we need to consider several
-    // vertices of the object to avoid it slipping through quads.
-    //
-    // The scale factor should be small enough such that the scaled width of
-    // the player mesh is less than the distance between corresponding portal
-    // meshes, but large enough that the projection quad never touches the
-    // portal stencil before we change chunks.
+void World::cross_portals(const glm::vec3& origin, const glm::vec3& move,
+                          uint32_t& chunk, RigidTransform& orientation,
+                          Arena& arena) const
+{
+  // For the same reasons as general collision, we need to consider several
+  // vertices of the object to avoid it slipping through quads.
+  //
+  // The scale factor should be small enough such that the scaled width of
+  // the player mesh is less than the distance between corresponding portal
+  // meshes, but large enough that the projection quad never touches the
+  // portal stencil before we change chunks.
+  const float scale_factor = .5f;
+  const auto& vertices = _player.get_mesh().physical_vertices();
+  float radius = 0;
+  for (const auto& v : vertices) {
+    radius = std::max(radius, glm::length(scale_factor * v));
+  }
+
+  // Only portals near the path can have been crossed.
+  auto inverse_orientation = orientation.inverse();
+  arena_vector<uint32_t> candidates{arena};
+  _chunks[chunk].portal_index.query(
+      inverse_orientation.point(origin), inverse_orientation.vector(move),
+      glm::vec3{radius}, candidates);
+  std::sort(candidates.begin(), candidates.end());
+
+  for (auto index : candidates) {
+    const auto& portal = _chunks[chunk].portals[index];
+    Object object{portal.portal_mesh.get(), orientation};
     bool crossed = false;
-    for (const auto& v : _player.get_mesh().physical_vertices()) {
-      const float scale_factor = .5f;
-      auto point = scale_factor * v + player_origin;
-      if (_collision.intersection(point, player_move, object)) {
+    for (const auto& v : vertices) {
+      auto point = scale_factor * v + origin;
+      if (_collision.intersection(point, move, object)) {
         crossed = true;
         break;
       }
@@ -110,174 +401,686 @@ void World::update(const ControlData& controls)
 
     // We probably want to translate back to the origin at some point (without
     // messing with normals, somehow).
-    _active_chunk = portal.chunk_name;
-    _orientation = _orientation * portal_matrix(portal);
+    if (portal.chunk == Portal::NO_CHUNK) {
+      continue;
+    }
+    chunk = portal.chunk;
+    // Renormalized so that many crossings don't add up to any drift.
+    orientation = (orientation * portal.transform).normalized();
     break;
   }
 }
 
-void World::render(RenderMetrics& metrics) const
+void World::start_loads(const Snapshot& snapshot)
 {
-  auto it = _chunks.find(_active_chunk);
-  if (it == _chunks.end()) {
-    return;
+  // Anything through a portal the player is close to counts as nearby, so
+  // that it's ready by the time they step through.
+  arena_vector<uint32_t> roots{_arena};
+  roots.push_back(snapshot.active_chunk);
+  const auto& chunk = _chunks[snapshot.active_chunk];
+  auto origin = snapshot.orientation.inverse().point(snapshot.player_position);
+  arena_vector<uint32_t> candidates{_arena};
+  chunk.portal_index.query(
+      origin, glm::vec3{}, glm::vec3{PREFETCH_DISTANCE}, candidates);
+  for (auto index : candidates) {
+    const auto& portal = chunk.portals[index];
+    if (portal.chunk != Portal::NO_CHUNK) {
+      roots.push_back(portal.chunk);
+    }
+  }
+  _residency.update(roots.data(), roots.size(), _to_load);
+
+  // Nearest first, so the active chunk is always ready before anything else.
+  // The world file is only ever read, so the loader can share it.
+  for (auto index : _to_load) {
+    if (_residency.loading_count() >= _residency.get_config().max_loads) {
+      break;
+    }
+    start_load(index);
   }
+}
 
-  const auto& head = _player.get_head_position();
-  auto look_at = head + _player.get_look_direction();
-  _renderer.perspective(
-      _player.get_fov(), _player.get_z_near(), _player.get_z_far());
-  _renderer.camera(head, look_at, {0, 1, 0});
-  _renderer.clear();
+void World::start_load(uint32_t index)
+{
+  _residency.set_loading(index);
+  _loads.run([this, index](uint32_t)
+  {
+    if (_stopping) {
+      return;
+    }
+    std::shared_ptr<const Mesh> mesh = std::make_shared<Mesh>(
+        _source->chunk(_chunk_sources[index]).mesh());
+    {
+      std::lock_guard<std::mutex> lock{_loaded_mutex};
+      _loaded.push_back({index, std::move(mesh)});
+    }
+    _loaded_condition.notify_one();
+  });
+}
+
+void World::finish_loads(FramePacket* packet)
+{
+  {
+    std::lock_guard<std::mutex> lock{_loaded_mutex};
+    _finished.swap(_loaded);
+  }
+  for (auto& loaded : _finished) {
+    const auto& mesh = *loaded.mesh;
+    _residency.set_loaded(loaded.index, mesh.cpu_bytes(), mesh.gpu_bytes());
+    if (packet) {
+      packet->upload(mesh);
+    }
+    std::atomic_store(&_chunks[loaded.index].mesh, std::move(loaded.mesh));
+    ++_chunk_changes;
+  }
+  _finished.clear();
+}
+
+void World::load_all()
+{
+  for (uint32_t i = 0; i < _chunks.size(); ++i) {
+    if (!_residency.is_loaded(i) && !_residency.is_loading(i)) {
+      start_load(i);
+    }
+  }
+  while (_residency.loading_count()) {
+    {
+      std::unique_lock<std::mutex> lock{_loaded_mutex};
+      _loaded_condition.wait(lock, [&]{ return !_loaded.empty(); });
+    }
+    finish_loads(nullptr);
+  }
+}
+
+void World::unload_chunks(FramePacket& packet)
+{
+  for (auto index = _residency.next_eviction(); index != Residency::NONE;
+       index = _residency.next_eviction()) {
+    auto& mesh = _chunks[index].mesh;
+    packet.release(mesh);
+    std::atomic_store(&mesh, std::shared_ptr<const Mesh>{});
+    _residency.set_unloaded(index);
+    ++_chunk_changes;
+  }
+}
+
+void World::render(RenderMetrics& metrics, double tick, FramePacket& packet)
+{
+  std::shared_ptr<const Snapshot> previous;
+  std::shared_ptr<const Snapshot> current;
+  {
+    std::lock_guard<std::mutex> lock{_snapshot_mutex};
+    previous = _previous_snapshot;
+    current = _current_snapshot;
+  }
+
+  const Snapshot* snapshot = current.get();
+  if (previous) {
+    auto t = (tick - previous->tick) / (current->tick - previous->tick);
+    interpolate(*previous, *current,
+                float(std::max(0., std::min(1., t))), _interpolated);
+    snapshot = &_interpolated;
+  }
+
+  _arena.reset();
+  if (!_chunks.empty()) {
+    finish_loads(&packet);
+    start_loads(*snapshot);
+  }
+  Camera camera{*snapshot, packet.dimensions()};
+
+  // Objects can move without anything else changing, so they're always
+  // gathered again.
+  graph_key key{
+      snapshot->active_chunk, snapshot->orientation, camera.eye,
+      camera.view_transform, camera.projection(), camera.pixel_scale,
+      _chunk_changes};
+  if (_graph && key == _graph_key) {
+    touch_chunks(*_graph);
+    gather_objects(*snapshot, *_graph);
+    metrics = _graph_metrics;
+    metrics.cached_graph = true;
+  } else {
+    _graph_arena.reset();
+    _graph = _graph_arena.create<FrameGraph>(_graph_arena);
+    build(camera, *snapshot, *_graph, metrics);
+    _graph_key = key;
+    _graph_metrics = metrics;
+  }
+  unload_chunks(packet);
+  submit(camera, *_graph, packet);
+
+  metrics.loading_chunks = _residency.loading_count();
+  metrics.resident_chunks = _residency.loaded_count();
+  metrics.resident_cpu_bytes = _residency.cpu_used();
+  metrics.resident_gpu_bytes = _residency.gpu_used();
+}
+
+void World::build(const Camera& camera, const Snapshot& snapshot,
+                  FrameGraph& graph, RenderMetrics& metrics)
+{
+  graph.first_iteration = 0;
+  graph.levels.clear();
+  graph.entries.clear();
+  graph.portals.clear();
+  graph.objects.clear();
+  graph.views.clear();
 
   metrics.chunks = 0;
   metrics.depth = 1;
   metrics.breadth = 1;
+  metrics.views = 0;
+  metrics.cached_views = 0;
+  metrics.cached_graph = false;
 
-  std::vector<chunk_entry> buffer_a;
-  std::vector<chunk_entry> buffer_b;
-  buffer_a.push_back(
-      {&it->second, nullptr, nullptr, 0, {_orientation, {}}, {{}, {}}});
+  for (auto& cache : _view_cache) {
+    cache.used = false;
+  }
+  if (!_chunks.empty() && _chunks[snapshot.active_chunk].mesh) {
+    _residency.touch(snapshot.active_chunk);
+    graph.levels.push_back({0, 1, 0, 0});
+    graph.entries.push_back({
+        &_chunks[snapshot.active_chunk], nullptr, nullptr, FrameGraph::NONE, 0,
+        {snapshot.orientation, {}}, {{}, {}}, 0, 0});
 
-  // TODO: could rewrite to build the scene graph in one step, and render it in
-  // another.
-  for (uint32_t i = 0; i < MAX_ITERATIONS; ++i) {
-    render_iteration(i, metrics, i % 2 ? buffer_b : buffer_a,
-                                 i % 2 ? buffer_a : buffer_b);
+    uint32_t chunk_budget = MAX_CHUNKS - 1;
+    build_graph(camera, graph, chunk_budget, metrics);
+  }
+  gather_objects(snapshot, graph);
+  // Views that weren't seen this frame free up their slots.
+  for (auto& cache : _view_cache) {
+    if (!cache.used) {
+      cache.portal = nullptr;
+    }
   }
 }
 
-void World::render_iteration(
-    uint32_t iteration, RenderMetrics& metrics,
-    const std::vector<chunk_entry>& read_buffer,
-    std::vector<chunk_entry>& write_buffer) const
+void World::build_graph(const Camera& camera, FrameGraph& graph,
+                        uint32_t& chunk_budget, RenderMetrics& metrics)
 {
-  write_buffer.clear();
-  if (read_buffer.empty()) {
-    return;
+  for (uint32_t i = 0; i < graph.levels.size(); ++i) {
+    build_level(i, camera, graph, chunk_budget, metrics);
   }
-  metrics.depth = std::max(metrics.depth, 1 + iteration);
+  metrics.chunks += uint32_t(graph.entries.size());
+  metrics.depth = std::max(
+      metrics.depth, graph.first_iteration + uint32_t(graph.levels.size()));
+}
 
+void World::build_level(uint32_t level_index, const Camera& camera,
+                        FrameGraph& graph, uint32_t& chunk_budget,
+                        RenderMetrics& metrics)
+{
+  auto iteration = graph.first_iteration + level_index;
   bool last_iteration = iteration + 1 >= MAX_ITERATIONS;
   uint32_t iteration_stencil = 0;
 
-  // For further iterations, these clip planes are mostly redundant - we could
-  // perhaps just use this for the first iteration and only keep the near/far
-  // depth planes after that.
-  const auto view_clip_planes =
-      calculate_view_frustum(_player, _renderer.get_aspect_ratio());
+  // Converts view-plane area to pixels.
+  auto pixel_area_scale = camera.pixel_scale * camera.pixel_scale;
 
-  // To avoid awkwardly-placed portals being seen through other stencils
-  // and messing up the buffer, and maximise the individual bit-
-  // combinations we can use to represent different portals per iteration,
-  // we do the following:
-  // (1) render a single flag bit into the stencil buffer for all portals,
-  //     with depth enabled
-  // (2) clear the value bits
-  // (3) rerender one of (127 - 1) remaining combinations of stencil bits
-  //     to the flagged areas only with depth function GL_EQUAL
-  // (4) clear depth and flag bit.
-  for (const auto& entry : read_buffer) {
-    auto visibility_clip_planes = view_clip_planes;
-    for (const auto& plane : entry.data.clip_planes) {
-      visibility_clip_planes.push_back(plane);
-    }
-
-    ++metrics.chunks;
-    // Establish depth buffer for this chunk.
-    uint32_t stencil_ref = combine_mask(false, entry.stencil);
-    _renderer.world(entry.data.orientation, entry.data.clip_planes);
-    _renderer.depth(entry.chunk->mesh->visible_data(), stencil_ref, VALUE_BITS);
-    // Renderer the chunk.
-    _renderer.draw(*entry.chunk->mesh, _player, stencil_ref, VALUE_BITS);
-    // Render the objects in the source chunk, with the clipping and
-    // stencilling of this chunk. This is necessary because the depth has
-    // been cleared since the last time we rendered it.
-    if (entry.source_chunk) {
-      render_objects_in_chunk(
-          iteration - 1, entry.source_chunk,
-          {entry.source_data.orientation, entry.data.clip_planes},
-          entry.stencil);
+  auto& level = graph.levels[level_index];
+  level.first_portal = uint32_t(graph.portals.size());
+
+  arena_vector<uint32_t> candidates{_arena};
+  arena_vector<portal_in_view> portals_in_view{_arena};
+  for (uint32_t i = 0; i < level.entry_count; ++i) {
+    auto index = level.first_entry + i;
+    const auto& entry = graph.entries[index];
+
+    // For further iterations, the view planes are mostly redundant - we could
+    // perhaps just use them for the first iteration and only keep the
+    // near/far depth planes after that.
+    auto visibility_clip_planes = camera.view_frustum;
+    visibility_clip_planes.append(entry.data.clip_planes);
+
+    // Only the portals whose bounds might be in view need to be considered.
+    // If we have precomputed visibility, that's further restricted to the
+    // ones which can be seen through the one we came in by.
+    candidates.clear();
+    entry.chunk->portal_index.query(
+        visibility_clip_planes.pull_back(entry.data.orientation), candidates);
+    std::sort(candidates.begin(), candidates.end());
+
+    if (entry.source && entry.chunk->has_portal_pvs) {
+      for (const auto& portal : entry.chunk->portals) {
+        if (portal.portal_id == entry.source->portal_id &&
+            &portal != entry.source) {
+          const auto& visible = portal.visible_portals;
+          candidates.erase(std::remove_if(
+              candidates.begin(), candidates.end(), [&](uint32_t index)
+              {
+                return !std::binary_search(
+                    visible.begin(), visible.end(), index);
+              }), candidates.end());
+          break;
+        }
+      }
     }
-    render_objects_in_chunk(iteration, entry.chunk, entry.data, stencil_ref);
 
-    for (const auto& portal : entry.chunk->portals) {
-      auto jt = _chunks.find(portal.chunk_name);
+    for (auto portal_index : candidates) {
+      const auto& portal = entry.chunk->portals[portal_index];
       bool is_source = entry.source &&
           portal.portal_id == entry.source->portal_id &&
           &portal != entry.source;
 
-      const auto& head = _player.get_head_position();
-      if (last_iteration || jt == _chunks.end() || is_source ||
-          !mesh_visible(visibility_clip_planes, head,
+      if (portal.chunk == Portal::NO_CHUNK || is_source ||
+          !mesh_visible(visibility_clip_planes, camera.eye,
                         entry.data.orientation, *portal.portal_mesh)) {
         continue;
       }
-      // TODO: this should really warn when we reuse stencil bits.
-      auto next_stencil = 1 + iteration_stencil++ % (VALUE_BITS - 1);
-      metrics.breadth = std::max(metrics.breadth, iteration_stencil);
-
-      auto next_orientation = entry.data.orientation * portal_matrix(portal);
-      auto portal_frustum = calculate_bounding_frustum(
-          _player, _renderer.get_aspect_ratio(),
-          entry.data.orientation, portal);
-
-      // Render the objects in the target chunk, with the clipping and
-      // stencilling of the source chunk.
-      render_objects_in_chunk(
-          1 + iteration, &jt->second,
-          {next_orientation, entry.data.clip_planes}, entry.stencil);
-
-      write_buffer.push_back({
-          &jt->second, &portal, entry.chunk, next_stencil,
-          {next_orientation, portal_frustum}, entry.data});
-
-      auto portal_stencil_ref = combine_mask(true, entry.stencil);
-      _renderer.world(entry.data.orientation, entry.data.clip_planes);
-      _renderer.stencil(
-          portal.portal_mesh->visible_data(), portal_stencil_ref,
-          /* read */ VALUE_BITS, /* write */ FLAG_BITS, /* depth_eq */ false);
-    }
-  }
-
-  _renderer.clear_stencil(VALUE_BITS);
-  // This part could theoretically cause artifacts when portals visible
-  // through different portals intersect exactly in camera space. However, if
-  // the portal clipping planes are calculated perfectly (which isn't always
-  // possible for complex portal meshes, since there is a hardware limitation
-  // on the number of clipping planes), such intersections are impossible.
-  // If such artifacts are encountered, we should improve the
-  // calculate_bounding_frustum algorithm.
-  for (const auto& entry : write_buffer) {
-    auto portal_stencil_ref = combine_mask(true, entry.stencil);
-    _renderer.world(entry.source_data.orientation,
-                    entry.source_data.clip_planes);
-    _renderer.stencil(
-        entry.source->portal_mesh->visible_data(), portal_stencil_ref,
-        /* read */ FLAG_BITS, /* write */ VALUE_BITS, /* depth_eq */ true);
-  }
-
-  _renderer.clear_depth(FLAG_BITS, FLAG_BITS);
-  _renderer.clear_stencil(FLAG_BITS);
+
+      // Chunks that aren't loaded are filled in, but will be loaded soon.
+      _residency.touch(portal.chunk);
+      ViewFootprint footprint;
+      auto portal_frustum = compose_frustum(
+          camera, entry.data.clip_planes,
+          calculate_bounding_frustum(
+              camera, entry.data.orientation, portal, _arena),
+          _arena, &footprint);
+      portals_in_view.push_back({
+          index, &portal, &_chunks[portal.chunk], portal_frustum,
+          footprint.area * pixel_area_scale, footprint.min, footprint.max});
+    }
+  }
+
+  // Recurse into the largest portals first, until we run out of budget.
+  // Anything else is just filled in, so that we don't see the chunk behind
+  // it instead.
+  std::stable_sort(
+      portals_in_view.begin(), portals_in_view.end(),
+      [](const portal_in_view& a, const portal_in_view& b)
+      {
+        return a.pixel_area > b.pixel_area;
+      });
+
+  auto first_child = uint32_t(graph.entries.size());
+  for (const auto& p : portals_in_view) {
+    // Copied, since adding entries moves them.
+    auto entry = graph.entries[p.entry];
+    FrameGraph::portal_draw draw{
+        p.entry, p.portal, FrameGraph::NONE, FrameGraph::NONE, 0, 0};
+    if (last_iteration || !chunk_budget ||
+        p.pixel_area < MIN_PORTAL_PIXELS || !p.target->mesh) {
+      graph.portals.push_back(draw);
+      continue;
+    }
+    --chunk_budget;
+    auto next_orientation =
+        entry.data.orientation * p.portal->transform;
+
+    // Only portals seen directly get offscreen views, so that the views
+    // don't depend on anything else that's been traversed.
+    if (!iteration) {
+      draw.view = build_view(camera, graph, p, chunk_budget, metrics);
+      if (draw.view != FrameGraph::NONE) {
+        graph.portals.push_back(draw);
+        continue;
+      }
+    }
+
+    // TODO: this should really warn when we reuse stencil bits.
+    auto next_stencil = 1 + iteration_stencil++ % (VALUE_BITS - 1);
+    metrics.breadth = std::max(metrics.breadth, iteration_stencil);
+
+    draw.child = uint32_t(graph.entries.size());
+    graph.entries.push_back({
+        p.target, p.portal, entry.chunk, p.entry, next_stencil,
+        {next_orientation, p.frustum}, entry.data, 0, 0});
+    graph.portals.push_back(draw);
+  }
+
+  // Levels may have moved too.
+  auto& built_level = graph.levels[level_index];
+  built_level.portal_count =
+      uint32_t(graph.portals.size()) - built_level.first_portal;
+  if (graph.entries.size() > first_child) {
+    graph.levels.push_back({
+        first_child, uint32_t(graph.entries.size()) - first_child, 0, 0});
+  }
+}
+
+uint32_t World::build_view(const Camera& camera, FrameGraph& graph,
+                           const portal_in_view& p, uint32_t& chunk_budget,
+                           RenderMetrics& metrics)
+{
+  const auto& entry = graph.entries[p.entry];
+  auto origin = entry.data.orientation.point(p.portal->local.origin);
+  auto distance = glm::length(origin - camera.eye);
+  if (distance < MIN_VIEW_DISTANCE) {
+    return FrameGraph::NONE;
+  }
+
+  uint32_t slot = FrameGraph::NONE;
+  uint32_t free_slot = FrameGraph::NONE;
+  for (uint32_t i = 0; i < _view_cache.size(); ++i) {
+    const auto& cache = _view_cache[i];
+    if (cache.portal == p.portal &&
+        cache.orientation == entry.data.orientation) {
+      slot = i;
+      break;
+    }
+    if (!cache.portal && free_slot == FrameGraph::NONE) {
+      free_slot = i;
+    }
+  }
+
+  // The old view can be reprojected if the parallax is small enough and the
+  // whole portal is still inside it.
+  if (slot != FrameGraph::NONE) {
+    auto& cache = _view_cache[slot];
+    bool reusable =
+        glm::length(camera.eye - cache.eye) <= distance * MAX_VIEW_PARALLAX;
+    const auto& bounds = p.portal->bounds;
+    for (uint32_t i = 0; reusable && i < 8; ++i) {
+      glm::vec3 corner{i & 1 ? bounds.max.x : bounds.min.x,
+                       i & 2 ? bounds.max.y : bounds.min.y,
+                       i & 4 ? bounds.max.z : bounds.min.z};
+      auto clip = cache.vp_transform *
+          glm::vec4{entry.data.orientation.point(corner), 1};
+      reusable = clip.w > 0 &&
+          std::abs(clip.x) <= clip.w && std::abs(clip.y) <= clip.w;
+    }
+    if (reusable) {
+      cache.used = true;
+      graph.views.push_back({slot, cache.view_min, cache.view_max,
+                             cache.dimensions, cache.vp_transform, nullptr});
+      ++metrics.cached_views;
+      return uint32_t(graph.views.size() - 1);
+    }
+  } else if (free_slot != FrameGraph::NONE) {
+    slot = free_slot;
+  } else if (_view_cache.size() < MAX_VIEWS) {
+    slot = uint32_t(_view_cache.size());
+    _view_cache.emplace_back();
+  } else {
+    return FrameGraph::NONE;
+  }
+
+  // Render the footprint at screen resolution, plus some margin.
+  auto margin = VIEW_MARGIN * (p.view_max - p.view_min);
+  auto view_camera = camera.window(p.view_min - margin, p.view_max + margin);
+  auto view_size = [&](float extent)
+  {
+    auto size = int32_t(std::ceil(extent * camera.pixel_scale));
+    return size < 1 ? 1 : size > MAX_VIEW_SIZE ? MAX_VIEW_SIZE : size;
+  };
+  glm::ivec2 dimensions{
+      view_size(view_camera.view_max.x - view_camera.view_min.x),
+      view_size(view_camera.view_max.y - view_camera.view_min.y)};
+  auto vp_transform = view_camera.projection() * view_camera.view_transform;
+
+  // Since only the portal itself is drawn with the view, it doesn't need
+  // clipping to the footprint, just to the window.
+  auto view_graph = graph.arena.create<FrameGraph>(graph.arena);
+  view_graph->first_iteration = 1;
+  view_graph->levels.push_back({0, 1, 0, 0});
+  view_graph->entries.push_back({
+      p.target, p.portal, entry.chunk, FrameGraph::NONE, 0,
+      {entry.data.orientation * p.portal->transform,
+       compose_frustum(
+           view_camera, entry.data.clip_planes,
+           calculate_bounding_frustum(
+               view_camera, entry.data.orientation, *p.portal, _arena),
+           _arena)},
+      entry.data, 0, 0});
+  build_graph(view_camera, *view_graph, chunk_budget, metrics);
+
+  _view_cache[slot] = {
+      p.portal, entry.data.orientation, camera.eye, vp_transform,
+      view_camera.view_min, view_camera.view_max, dimensions, true};
+  graph.views.push_back({slot, view_camera.view_min, view_camera.view_max,
+                         dimensions, vp_transform, view_graph});
+  ++metrics.views;
+  return uint32_t(graph.views.size() - 1);
+}
+
+bool World::graph_key::operator==(const graph_key& key) const
+{
+  return active_chunk == key.active_chunk &&
+      orientation == key.orientation && eye == key.eye &&
+      view_transform == key.view_transform &&
+      projection == key.projection && pixel_scale == key.pixel_scale &&
+      chunk_changes == key.chunk_changes;
+}
+
+void World::gather_objects(const Snapshot& snapshot, FrameGraph& graph) const
+{
+  graph.objects.clear();
+  for (auto& entry : graph.entries) {
+    // Render the objects in the source chunk, with the clipping and
+    // stencilling of this chunk. This is necessary because the depth has
+    // been cleared since the last time we rendered it.
+    entry.first_object = uint32_t(graph.objects.size());
+    if (entry.source_chunk) {
+      add_objects_in_chunk(
+          graph, snapshot, entry.source_chunk,
+          {entry.source_data.orientation, entry.data.clip_planes},
+          entry.stencil);
+    }
+    add_objects_in_chunk(graph, snapshot, entry.chunk, entry.data,
+                         combine_mask(false, entry.stencil));
+    entry.object_count = uint32_t(graph.objects.size()) - entry.first_object;
+  }
+
+  for (auto& draw : graph.portals) {
+    draw.first_object = uint32_t(graph.objects.size());
+    draw.object_count = 0;
+    if (draw.child == FrameGraph::NONE && draw.view == FrameGraph::NONE) {
+      continue;
+    }
+    // Render the objects in the target chunk, with the clipping and
+    // stencilling of the source chunk.
+    const auto& entry = graph.entries[draw.entry];
+    add_objects_in_chunk(
+        graph, snapshot, &_chunks[draw.portal->chunk],
+        {entry.data.orientation * draw.portal->transform,
+         entry.data.clip_planes}, entry.stencil);
+    draw.object_count = uint32_t(graph.objects.size()) - draw.first_object;
+  }
+
+  for (const auto& view : graph.views) {
+    if (view.graph) {
+      gather_objects(snapshot, *view.graph);
+    }
+  }
 }
 
-void World::render_objects_in_chunk(
-    uint32_t iteration, const Chunk* chunk,
-    const world_data& data, uint32_t stencil_ref) const
+void World::touch_chunks(const FrameGraph& graph)
 {
-  // Since we currently only have a player, "get objects in chunk" is just
-  // "get the player in the active_chunk on nonzero iterations".
-  auto it = _chunks.find(_active_chunk);
-  if (it != _chunks.end() && chunk == &it->second && iteration) {
-    auto inv_orientation = glm::inverse(_orientation);
-    auto translate = glm::translate(glm::mat4{}, _player.get_position());
-    auto transform = data.orientation * inv_orientation * translate;
+  for (const auto& entry : graph.entries) {
+    _residency.touch(uint32_t(entry.chunk - _chunks.data()));
+  }
+  for (const auto& draw : graph.portals) {
+    _residency.touch(draw.portal->chunk);
+  }
+  for (const auto& view : graph.views) {
+    if (view.graph) {
+      touch_chunks(*view.graph);
+    }
+  }
+}
+
+void World::add_objects_in_chunk(
+    FrameGraph& graph, const Snapshot& snapshot, const Chunk* chunk,
+    const FrameGraph::world_data& data, uint32_t stencil_ref) const
+{
+  auto index = uint32_t(chunk - _chunks.data());
+  if (index + 1 >= snapshot.chunk_objects.size()) {
+    return;
+  }
+  for (auto i = snapshot.chunk_objects[index];
+       i < snapshot.chunk_objects[1 + index]; ++i) {
+    const auto& object = snapshot.objects[i];
+    auto transform = data.orientation * object.transform;
+    const auto& origin = transform.translation;
+
+    // The player (or a ghost of them) is only drawn when seen from somewhere
+    // other than where they actually are.
+    if (object.object == snapshot.player_object &&
+        glm::length(origin - snapshot.player_position) < 1. / 1024) {
+      continue;
+    }
+    glm::vec3 radius{object.radius};
+    if (data.clip_planes.excludes_box(origin - radius, origin + radius)) {
+      continue;
+    }
 
     // TODO: for rendering objects from a different chunk than we're rendering
     // in, we need to do some kind of determination to see if they're inside the
     // portal area. Otherwise, this could result in artifact objects from
     // overlapping spaces.
-    _renderer.world(transform, data.clip_planes);
-    _renderer.draw(_player.get_mesh(), _player, stencil_ref, VALUE_BITS);
+    graph.objects.push_back(
+        {object.mesh, {transform, data.clip_planes}, stencil_ref});
+  }
+}
+
+void World::submit(const Camera& camera, const FrameGraph& graph,
+                   FramePacket& packet)
+{
+  // Offscreen views first, since they're composited into the main graph.
+  for (const auto& view : graph.views) {
+    if (!view.graph) {
+      continue;
+    }
+    auto view_camera = camera.window(view.view_min, view.view_max);
+    packet.begin_view(view.slot, view.dimensions);
+    packet.camera(view_camera);
+    submit_graph(*view.graph, packet);
+    packet.end_view();
+  }
+
+  packet.camera(camera);
+  packet.clear();
+  submit_graph(graph, packet);
+}
+
+void World::submit_graph(const FrameGraph& graph, FramePacket& packet)
+{
+  // To avoid awkwardly-placed portals being seen through other stencils
+  // and messing up the buffer, and maximise the individual bit-
+  // combinations we can use to represent different portals per iteration,
+  // we do the following:
+  // (1) render a single flag bit into the stencil buffer for all portals,
+  //     with depth enabled
+  // (2) clear the value bits
+  // (3) rerender one of (127 - 1) remaining combinations of stencil bits
+  //     to the flagged areas only with depth function GL_EQUAL
+  // (4) clear depth and flag bit.
+  //
+  // The stencil draw for each portal is wrapped in an occlusion query, and
+  // everything drawn for the resulting entry is rendered conditionally on it,
+  // so portals hidden behind other geometry cost nothing on the GPU. Since
+  // the next portal stencils are themselves conditional, hidden subtrees are
+  // skipped entirely.
+  //
+  // Entries of a level showing the same chunk are drawn together, as
+  // instances with their own transforms and stencil refs. Hidden ones still
+  // get drawn that way, but their stencil is never set, so nothing shows.
+  arena_vector<uint32_t> queries(
+      graph.entries.size(), FramePacket::NONE, _arena);
+  auto draw_objects = [&](uint32_t first, uint32_t count)
+  {
+    for (uint32_t i = first; i < first + count; ++i) {
+      const auto& object = graph.objects[i];
+      packet.world(object.data.orientation, object.data.clip_planes);
+      packet.draw(*object.mesh, object.stencil_ref, VALUE_BITS);
+    }
+  };
+
+  arena_vector<uint32_t> by_chunk{_arena};
+  for (uint32_t l = 0; l < graph.levels.size(); ++l) {
+    const auto& level = graph.levels[l];
+    by_chunk.clear();
+    for (uint32_t i = 0; i < level.entry_count; ++i) {
+      by_chunk.push_back(level.first_entry + i);
+    }
+    std::sort(by_chunk.begin(), by_chunk.end(), [&](uint32_t a, uint32_t b)
+    {
+      auto a_id = graph.entries[a].chunk->mesh->id();
+      auto b_id = graph.entries[b].chunk->mesh->id();
+      return a_id != b_id ? a_id < b_id : a < b;
+    });
+
+    for (uint32_t i = 0; i < by_chunk.size();) {
+      const auto& mesh = *graph.entries[by_chunk[i]].chunk->mesh;
+      uint32_t first_instance = FramePacket::NONE;
+      uint32_t count = 0;
+      for (; i < by_chunk.size() &&
+             graph.entries[by_chunk[i]].chunk->mesh.get() == &mesh; ++i) {
+        const auto& entry = graph.entries[by_chunk[i]];
+        auto instance = packet.instance(
+            entry.data.orientation, entry.data.clip_planes,
+            combine_mask(false, entry.stencil), queries[by_chunk[i]]);
+        first_instance = std::min(first_instance, instance);
+        ++count;
+      }
+      // Establish depth buffer for the chunk, then render it.
+      packet.depth_instances(mesh, first_instance, count, VALUE_BITS);
+      packet.draw_instances(mesh, first_instance, count, VALUE_BITS);
+    }
+
+    // Outlines and objects are drawn per entry, in its own world.
+    for (uint32_t i = 0; i < level.entry_count; ++i) {
+      auto index = level.first_entry + i;
+      const auto& entry = graph.entries[index];
+      packet.begin_condition(queries[index]);
+      packet.world(entry.data.orientation, entry.data.clip_planes);
+      packet.outline(*entry.chunk->mesh,
+                     combine_mask(false, entry.stencil), VALUE_BITS);
+      draw_objects(entry.first_object, entry.object_count);
+      packet.end_condition();
+    }
+
+    for (uint32_t i = 0; i < level.portal_count; ++i) {
+      const auto& draw = graph.portals[level.first_portal + i];
+      const auto& entry = graph.entries[draw.entry];
+      packet.begin_condition(queries[draw.entry]);
+      draw_objects(draw.first_object, draw.object_count);
+      packet.world(entry.data.orientation, entry.data.clip_planes);
+      if (draw.view != FrameGraph::NONE) {
+        const auto& view = graph.views[draw.view];
+        packet.composite(
+            *draw.portal->portal_mesh, view.slot,
+            view.vp_transform, combine_mask(false, entry.stencil), VALUE_BITS);
+      } else if (draw.child == FrameGraph::NONE) {
+        packet.fill(*draw.portal->portal_mesh,
+                    combine_mask(false, entry.stencil), VALUE_BITS);
+      } else {
+        auto query = packet.query();
+        queries[draw.child] = query;
+        packet.stencil(
+            *draw.portal->portal_mesh,
+            combine_mask(true, entry.stencil),
+            /* read */ VALUE_BITS, /* write */ FLAG_BITS, /* depth_eq */ false,
+            query);
+      }
+      packet.end_condition();
+    }
+
+    packet.clear_stencil(VALUE_BITS);
+    // This part could theoretically cause artifacts when portals visible
+    // through different portals intersect exactly in camera space. However,
+    // if the portal clipping planes are calculated perfectly (which isn't
+    // always possible for complex portal meshes, since there is a hardware
+    // limitation on the number of clipping planes), such intersections are
+    // impossible. If such artifacts are encountered, we should improve the
+    // calculate_bounding_frustum algorithm.
+    if (l + 1 < graph.levels.size()) {
+      const auto& next = graph.levels[l + 1];
+      for (uint32_t i = 0; i < next.entry_count; ++i) {
+        auto index = next.first_entry + i;
+        const auto& entry = graph.entries[index];
+        packet.begin_condition(queries[index]);
+        packet.world(entry.source_data.orientation,
+                     entry.source_data.clip_planes);
+        packet.stencil(
+            *entry.source->portal_mesh,
+            combine_mask(true, entry.stencil),
+            /* read */ FLAG_BITS, /* write */ VALUE_BITS, /* depth_eq */ true);
+        packet.end_condition();
+      }
+    }
+
+    packet.clear_depth(FLAG_BITS, FLAG_BITS);
+    packet.clear_stencil(FLAG_BITS);
   }
 }
@@ -1,13 +1,26 @@
 #ifndef MOBIUS_WORLD_H
 #define MOBIUS_WORLD_H
 
+#include "agents.h"
+#include "arena.h"
+#include "bvh.h"
 #include "collision.h"
+#include "jobs.h"
+#include "plane_set.h"
 #include "player.h"
+#include "registry.h"
+#include "residency.h"
+#include "rigid_transform.h"
+#include "snapshot.h"
+#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 #include <glm/mat4x4.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 struct Orientation {
@@ -17,67 +30,372 @@ struct Orientation {
 };
 
 struct Portal {
+  static const uint32_t NO_CHUNK = 0xffffffff;
+
   std::string chunk_name;
+  // Index of the target chunk, or NO_CHUNK if there isn't one by that name.
+  uint32_t chunk = NO_CHUNK;
   uint32_t portal_id;
 
   std::unique_ptr<Mesh> portal_mesh;
   Orientation local;
   Orientation remote;
+
+  // Portals in this chunk which might be seen through this one.
+  std::vector<uint32_t> visible_portals;
+
+  // Bounds of the portal mesh.
+  Bounds bounds;
+  // Takes the target chunk's space to this chunk's space, placing the target
+  // where it's seen through the portal; so a chunk seen through it has
+  // orientation * transform. The inverse takes this chunk's space to the
+  // target's, as for ghosts of objects straddling the portal.
+  RigidTransform transform;
+  RigidTransform inverse_transform;
 };
 
+namespace mobius {
+  namespace proto {
+    class world;
+  }
+}
+
 struct Chunk {
-  std::unique_ptr<Mesh> mesh;
+  std::string name;
+  // Null unless the chunk is resident. It's swapped on the main thread, so
+  // anything else has to use std::atomic_load.
+  std::shared_ptr<const Mesh> mesh;
   std::vector<Portal> portals;
+  bool has_portal_pvs = false;
+  // Bounds of the portals in chunk space.
+  Bvh portal_index;
 };
 
 struct RenderMetrics {
   uint32_t chunks;
   uint32_t depth;
   uint32_t breadth;
+  uint32_t views;
+  uint32_t cached_views;
+  // True if the graph was kept from the last frame.
+  bool cached_graph;
+  uint32_t loading_chunks;
+  uint32_t resident_chunks;
+  size_t resident_cpu_bytes;
+  size_t resident_gpu_bytes;
 };
 
-class Renderer;
-class World {
-public:
-  World(const std::string& path, Renderer& renderer);
+// Everything to be drawn in a frame, built without touching GL so that it
+// can be inspected (or built elsewhere) before being submitted. It lives in
+// an arena, along with the graphs of any offscreen views.
+struct FrameGraph {
+  static const uint32_t NONE = 0xffffffff;
 
-  void update(const ControlData& controls);
-  void render(RenderMetrics& metrics) const;
+  explicit FrameGraph(Arena& arena)
+  : arena(arena)
+  , levels{arena}
+  , entries{arena}
+  , portals{arena}
+  , objects{arena}
+  , views{arena}
+  {
+  }
 
-private:
-  typedef std::pair<glm::vec3, glm::vec3> plane;
   struct world_data {
-    glm::mat4 orientation;
-    std::vector<plane> clip_planes;
+    RigidTransform orientation;
+    PlaneSet clip_planes;
+  };
+
+  struct object_draw {
+    const Mesh* mesh;
+    world_data data;
+    uint32_t stencil_ref;
   };
 
-  struct chunk_entry {
+  // A chunk seen through a portal (or the active chunk, at the root).
+  struct entry {
     const Chunk* chunk;
     const Portal* source;
     const Chunk* source_chunk;
+    uint32_t parent;
     uint32_t stencil;
 
     world_data data;
     world_data source_data;
+
+    // Objects drawn along with the chunk.
+    uint32_t first_object;
+    uint32_t object_count;
+  };
+
+  // A portal visible from some entry, which is either recursed into (child),
+  // composited from an offscreen view, or just filled in.
+  struct portal_draw {
+    uint32_t entry;
+    const Portal* portal;
+    uint32_t child;
+    uint32_t view;
+
+    // Objects from the child chunk drawn in front of the portal.
+    uint32_t first_object;
+    uint32_t object_count;
+  };
+
+  // Entries of the same recursion depth, and the portals seen from them.
+  // The children of one level are exactly the entries of the next.
+  struct level {
+    uint32_t first_entry;
+    uint32_t entry_count;
+    uint32_t first_portal;
+    uint32_t portal_count;
+  };
+
+  // The view through a portal rendered offscreen, from the given window of
+  // the view plane. If there's no graph, the one rendered on an earlier frame
+  // is still good enough.
+  struct portal_view {
+    uint32_t slot;
+    glm::vec2 view_min;
+    glm::vec2 view_max;
+    glm::ivec2 dimensions;
+    glm::mat4 vp_transform;
+    FrameGraph* graph;
+  };
+
+  Arena& arena;
+  // Recursion depth of the root.
+  uint32_t first_iteration = 0;
+  arena_vector<level> levels;
+  arena_vector<entry> entries;
+  arena_vector<portal_draw> portals;
+  arena_vector<object_draw> objects;
+  arena_vector<portal_view> views;
+};
+
+struct Camera;
+class FramePacket;
+class World {
+public:
+  // Chunks are loaded, and agents stepped, on the given jobs.
+  World(const std::string& path, Jobs& jobs,
+        const Residency::config& residency = Residency::config{});
+  ~World();
+
+  // Update and render can be called from different threads. Each update is
+  // one tick of the simulation, and publishes a snapshot of it; render only
+  // looks at the snapshots, interpolating between the two either side of the
+  // given (fractional) tick. Neither makes any GL calls: render records the
+  // frame into a packet to be played back by the renderer.
+  //
+  // Render also streams chunk meshes in and out around the player. They're
+  // built in the background, and until the active chunk is ready, update
+  // does nothing and render draws nothing.
+  void update(const ControlData& controls);
+  void render(RenderMetrics& metrics, double tick, FramePacket& packet);
+
+  // Steps a batch of agents by one tick, each with its own controls, spread
+  // across the jobs. Only the world's chunks are touched, so this can go
+  // alongside render, but not alongside the other update.
+  void update(Agents& agents, const std::vector<ControlData>& controls);
+  // Adds agents where the player starts.
+  void spawn(Agents& agents, uint32_t count) const;
+
+  // Without rendering, nothing is ever streamed in, so a world that's only
+  // being simulated should load everything up front. This waits until it's
+  // all there, and should be called from whichever thread would render.
+  void load_all();
+
+  // Render is just build followed by submit, except that the graph is kept
+  // from frame to frame for as long as the view is static. Any change to it
+  // rebuilds the whole graph, since portal frusta are worked out on the view
+  // plane and so differ in every level once the camera turns. The graph
+  // itself lives in the world's graph arena, until the next rebuild; both
+  // use the render arena for scratch space.
+  void build(const Camera& camera, const Snapshot& snapshot,
+             FrameGraph& graph, RenderMetrics& metrics);
+  void submit(const Camera& camera, const FrameGraph& graph,
+              FramePacket& packet);
+
+private:
+  struct portal_in_view {
+    uint32_t entry;
+    const Portal* portal;
+    const Chunk* target;
+    PlaneSet frustum;
+    float pixel_area;
+    glm::vec2 view_min;
+    glm::vec2 view_max;
   };
 
-  void render_iteration(
-      uint32_t iteration, RenderMetrics& metrics,
-      const std::vector<chunk_entry>& read_buffer,
-      std::vector<chunk_entry>& write_buffer) const;
+  // What an offscreen view was last rendered from.
+  struct view_cache {
+    const Portal* portal;
+    RigidTransform orientation;
+    glm::vec3 eye;
+    glm::mat4 vp_transform;
+    glm::vec2 view_min;
+    glm::vec2 view_max;
+    glm::ivec2 dimensions;
+    bool used;
+  };
+
+  // What a graph was built from. While none of it changes, the graph stays
+  // the same, apart from its objects; otherwise it's rebuilt from scratch.
+  struct graph_key {
+    uint32_t active_chunk;
+    RigidTransform orientation;
+    glm::vec3 eye;
+    glm::mat4 view_transform;
+    glm::mat4 projection;
+    float pixel_scale;
+    uint64_t chunk_changes;
 
-  void render_objects_in_chunk(
-      uint32_t iteration, const Chunk* chunk,
-      const world_data& data, uint32_t stencil_ref) const;
+    bool operator==(const graph_key& key) const;
+  };
+
+  void build_graph(const Camera& camera, FrameGraph& graph,
+                   uint32_t& chunk_budget, RenderMetrics& metrics);
+  void build_level(uint32_t level_index, const Camera& camera,
+                   FrameGraph& graph, uint32_t& chunk_budget,
+                   RenderMetrics& metrics);
+  // Returns the index of the view in the graph, or NONE if the portal isn't
+  // suitable for one.
+  uint32_t build_view(const Camera& camera, FrameGraph& graph,
+                      const portal_in_view& p, uint32_t& chunk_budget,
+                      RenderMetrics& metrics);
+  // Fills in the objects drawn with each entry and portal of the graph (and
+  // its views), replacing any that were there.
+  void gather_objects(const Snapshot& snapshot, FrameGraph& graph) const;
+  // Marks everything in the graph as used, for a frame that didn't build it.
+  void touch_chunks(const FrameGraph& graph);
+  // Draws with whichever camera was set last.
+  void submit_graph(const FrameGraph& graph, FramePacket& packet);
+
+  void add_objects_in_chunk(
+      FrameGraph& graph, const Snapshot& snapshot, const Chunk* chunk,
+      const FrameGraph::world_data& data, uint32_t stencil_ref) const;
+  void move_player(const ControlData& controls);
+  void publish();
+  // Adds the chunk, and any seen through its portals, to the environment as
+  // they would be seen from the orientation. Meshes are looked up by chunk,
+  // and chunks without one are left out.
+  void add_environment(
+      uint32_t chunk, const RigidTransform& orientation,
+      const std::function<const Mesh*(uint32_t chunk)>& mesh,
+      std::vector<Object>& environment) const;
+  // Moves something the shape of the player into the next chunk, if it went
+  // through a portal in moving from the origin.
+  void cross_portals(const glm::vec3& origin, const glm::vec3& move,
+                     uint32_t& chunk, RigidTransform& orientation,
+                     Arena& arena) const;
+  // Starts loading the chunks wanted around the snapshot, a few at a time,
+  // and picks up the ones that have finished. Unloading waits until after
+  // the frame has been built, so that nothing seen in it goes.
+  void start_loads(const Snapshot& snapshot);
+  void start_load(uint32_t index);
+  // Finished meshes are queued in the packet for upload, if there is one.
+  void finish_loads(FramePacket* packet);
+  void unload_chunks(FramePacket& packet);
+  // Places the object in the chunk, along with ghosts on the far side of any
+  // portals it straddles.
+  void place_object(uint32_t object, uint32_t chunk,
+                    const RigidTransform& transform);
 
   static const uint32_t MAX_ITERATIONS = 8;
+  // Agents are stepped this many at a time.
+  static const uint32_t AGENT_SLICE = 256;
+  // Budget of chunks rendered per frame.
+  static const uint32_t MAX_CHUNKS = 128;
+  // Portals smaller than this on-screen are filled rather than recursed into.
+  static constexpr float MIN_PORTAL_PIXELS = 64;
+  // Portals seen directly at least this far away are rendered offscreen and
+  // composited, reusing the result for as long as the eye has moved less
+  // than MAX_VIEW_PARALLAX times the distance.
+  static constexpr float MIN_VIEW_DISTANCE = 16;
+  static constexpr float MAX_VIEW_PARALLAX = 1. / 128;
+  // Views are rendered with some margin, so that they can be reused while
+  // turning.
+  static constexpr float VIEW_MARGIN = 1. / 8;
+  static const uint32_t MAX_VIEWS = 8;
+  static const int32_t MAX_VIEW_SIZE = 2048;
+  // Chunks through portals this close to the player are loaded as though
+  // they were the active one.
+  static constexpr float PREFETCH_DISTANCE = 8;
+
+  Jobs& _jobs;
 
-  Renderer& _renderer;
-  std::unordered_map<std::string, Chunk> _chunks;
-  std::string _active_chunk;
-  glm::mat4 _orientation;
+  // Never changed after loading (except for chunk meshes, see Chunk), so both
+  // threads can use them.
+  std::vector<Chunk> _chunks;
+
+  // Simulation state, only touched by update.
+  uint64_t _tick = 0;
+  uint32_t _active_chunk = 0;
+  RigidTransform _orientation;
   Collision _collision;
   Player _player;
+  ObjectRegistry _objects;
+  uint32_t _player_object;
+  // Scratch space for the current update, reset at the start of each. The
+  // environment is kept between updates to keep its capacity.
+  Arena _update_arena;
+  std::vector<Object> _environment;
+  // Holds on to the meshes used in the update: just the active chunk and its
+  // neighbours, so that the cost doesn't grow with the world.
+  std::vector<std::pair<uint32_t, std::shared_ptr<const Mesh>>>
+      _environment_meshes;
+  // Indexed by chunk, for agents, which could be anywhere. Only filled in
+  // once per batch, so it's shared by all of them.
+  std::vector<std::shared_ptr<const Mesh>> _agent_meshes;
+  // The same, for stepping agents on each thread.
+  struct agent_scratch {
+    Arena arena;
+    std::vector<Object> environment;
+  };
+  PerThread<agent_scratch> _agent_scratch;
+  // Snapshots are recycled once nothing else holds them.
+  std::vector<std::shared_ptr<Snapshot>> _snapshot_pool;
+
+  // The latest two snapshots, handed from update to render.
+  mutable std::mutex _snapshot_mutex;
+  std::shared_ptr<const Snapshot> _previous_snapshot;
+  std::shared_ptr<const Snapshot> _current_snapshot;
+
+  // Render state, only touched by render.
+  Arena _arena;
+  Snapshot _interpolated;
+  // Indexed by view slot.
+  std::vector<view_cache> _view_cache;
+
+  // Streaming state, only touched by render. Chunk meshes are loaded from the
+  // world file, which is kept around for the purpose.
+  std::unique_ptr<mobius::proto::world> _source;
+  // Index of each chunk in the world file.
+  std::vector<int> _chunk_sources;
+  Residency _residency;
+  std::vector<uint32_t> _to_load;
+  // Counts chunks loaded and unloaded, since the graph depends on them.
+  uint64_t _chunk_changes = 0;
+
+  // The last graph built, and what it was built from.
+  Arena _graph_arena;
+  FrameGraph* _graph = nullptr;
+  graph_key _graph_key;
+  RenderMetrics _graph_metrics;
+
+  // Meshes built by the loader, waiting to be picked up by render.
+  struct loaded_chunk {
+    uint32_t index;
+    std::shared_ptr<const Mesh> mesh;
+  };
+  std::mutex _loaded_mutex;
+  std::condition_variable _loaded_condition;
+  std::vector<loaded_chunk> _loaded;
+  std::vector<loaded_chunk> _finished;
+  // Loads check this first, so that they stop early once the world is going.
+  std::atomic<bool> _stopping{false};
+  // Last, so that loads are finished before anything they use goes.
+  Jobs::Group _loads;
 };
 
 #endif